@@ -143,6 +143,7 @@ static const CommandLineOption options[] = {
     {"--dry-run", "don't actually write anything"},
     {"--create-dump", "don't create the repository but a dump file suitable for piping into fast-import"},
     {"--debug-rules", "print what rule is being used for each file"},
+    {"--qregexp", "run the regular expressions of the rules with QRegExp instead of PCRE2, which is slower"},
     {"--commit-interval NUMBER", "if passed the cache will be flushed to git every NUMBER of commits"},
     {"--stats", "after a run print some statistics about the rules"},
     {"--svn-branches", "Use the contents of SVN when creating branches, Note: SVN tags are branches as well"},
@@ -150,6 +151,20 @@ static const CommandLineOption options[] = {
     {"--svn-ignore", "Import svn-ignore-properties via .gitignore"},
     {"--propcheck", "Check for svn-properties except svn-ignore"},
     {"--fast-import-timeout SECONDS", "number of seconds to wait before terminating fast-import, 0 to wait forever"},
+    {"--prefetch NUMBER", "read the changed paths and properties of up to NUMBER upcoming revisions on worker threads"},
+    {"--dir-cache-size MB", "keep up to MB megabytes of directory listings cached (default 64)"},
+    {"--reader-threads NUMBER", "read file contents ahead of fast-import on NUMBER worker threads"},
+    {"--walk-threads NUMBER", "list the directories of copied and recursively exported trees ahead of the export on NUMBER worker threads"},
+    {"--fs-cache-size MB", "size of the cache Subversion keeps for the repository data in megabytes"},
+    {"--fs-cache TYPES", "comma separated FSFS caches to enable: deltas, fulltexts, revprops, nodeprops"},
+    {"--dump FILE", "load the svnadmin dump FILE, or - for standard input, into SVN_REPO_DIR while exporting it; the repository is created if needed"},
+    {"--transaction-memory MB", "keep at most MB megabytes of file records of a revision in memory, spill the rest to temporary files"},
+    {"--changes-index FILE", "keep the changed paths of all revisions in FILE, reuse it in later runs and skip revisions that only touch ignored paths"},
+    {"--readahead REVISIONS", "ask the kernel to read ahead the revision files of the next REVISIONS revisions and drop those further behind"},
+    {"--blob-cache DIR", "keep the blobs in the bare repository DIR, which the output repositories use as an alternate, and reuse them in later runs"},
+    {"--svn-eol-style", "normalize the line endings of files with svn:eol-style to LF"},
+    {"--svn-keywords", "unexpand the keywords listed in svn:keywords, like $Id: ... $ to $Id$"},
+    {"--lfs-threshold BYTES", "store files of at least BYTES bytes as Git LFS objects, see also lfs in the rules"},
     {"-h, --help", "show help"},
     {"-v, --version", "show version"},
     CommandLineLastOption
@@ -270,13 +285,24 @@ int main(int argc, char **argv)
         domain = QString("localhost");
     svn.setIdentityDomain(domain);
 
-    if (max_rev < 1)
+    // a dump is loaded while we export, so we cannot know its last revision yet
+    const bool dumpInput = args->contains(QLatin1String("dump"));
+    if (max_rev < 1 && !dumpInput)
         max_rev = svn.youngestRevision();
 
     bool errors = false;
     QSet<int> revisions = loadRevisionsFile(args->optionArgument(QLatin1String("revisions-file")), svn);
     const bool filerRevisions = !revisions.isEmpty();
-    for (int i = min_rev; i <= max_rev; ++i) {
+    if (args->contains(QLatin1String("prefetch")) && !dumpInput) {
+        QList<int> exportedRevisions;
+        for (int i = min_rev; i <= max_rev; ++i)
+            if (!filerRevisions || revisions.contains(i))
+                exportedRevisions.append(i);
+        svn.prefetchRevisions(exportedRevisions);
+    }
+    for (int i = min_rev; max_rev < 1 || i <= max_rev; ++i) {
+        if (!svn.waitForRevision(i))
+            break;
         if(filerRevisions) {
             if( !revisions.contains(i) ) {
                 printf(".");
@@ -290,6 +316,8 @@ int main(int argc, char **argv)
             break;
         }
     }
+    if (svn.inputFailed())
+        errors = true;
 
     foreach (Repository *repo, repositories) {
         repo->finalizeTags();
@@ -19,16 +19,153 @@
 #include "repository.h"
 #include "CommandLineParser.h"
 #include <QTextStream>
+#include <QCryptographicHash>
 #include <QDataStream>
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QLinkedList>
+#include <QSaveFile>
+#include <QTemporaryFile>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 
 static const int maxSimultaneousProcesses = 100;
 
 typedef unsigned long long mark_t;
 static const mark_t maxMark = ULONG_MAX;
+static const mark_t maxContentMark = maxMark / 2;
+static const int maxContentMarks = 2 * 1024 * 1024;
+
+// appended to the patterns of .gitattributes for the files stored in Git LFS
+static const char lfsAttributes[] = " filter=lfs diff=lfs merge=lfs -text";
+
+// files of at least this size are stored in Git LFS, 0 if no size is
+static qint64 lfsThreshold()
+{
+    static qint64 threshold = -1;
+    if (threshold < 0)
+        threshold = qMax(0LL, CommandLineParser::instance()->optionArgument(QLatin1String("lfs-threshold"), QLatin1String("0")).toLongLong());
+    return threshold;
+}
+
+// a path of .gitattributes matches only itself, relative to the root
+static QByteArray lfsAttributePattern(const QString &path)
+{
+    QByteArray pattern = "/";
+    foreach (char c, path.toUtf8()) {
+        if (c == ' ') {
+            pattern += "[[:space:]]";
+            continue;
+        }
+        if (c == '\\' || c == '*' || c == '?' || c == '[')
+            pattern += '\\';
+        pattern += c;
+    }
+    return pattern;
+}
+
+// the bracket expression of a pattern starting at i as one of QRegExp,
+// empty if it is not closed
+static QString lfsBracketExpression(const QString &pattern, int *i)
+{
+    static const char *const classes[][2] = {
+        { "[:alnum:]", "a-zA-Z0-9" }, { "[:alpha:]", "a-zA-Z" }, { "[:digit:]", "0-9" },
+        { "[:lower:]", "a-z" }, { "[:space:]", "\\s" }, { "[:upper:]", "A-Z" }
+    };
+
+    QString expression = "[";
+    int j = *i + 1;
+    if (j < pattern.size() && (pattern.at(j) == '!' || pattern.at(j) == '^')) {
+        expression += '^';
+        ++j;
+    }
+    // a ] right at the start is taken literally
+    if (j < pattern.size() && pattern.at(j) == ']') {
+        expression += "\\]";
+        ++j;
+    }
+    while (j < pattern.size() && pattern.at(j) != ']') {
+        bool named = false;
+        for (size_t k = 0; k < sizeof(classes) / sizeof(classes[0]); ++k) {
+            if (pattern.mid(j, int(strlen(classes[k][0]))) == QLatin1String(classes[k][0])) {
+                expression += QLatin1String(classes[k][1]);
+                j += int(strlen(classes[k][0]));
+                named = true;
+                break;
+            }
+        }
+        if (named)
+            continue;
+        if (pattern.at(j) == '\\' && j + 1 < pattern.size())
+            ++j;
+        if (pattern.at(j) == '\\' || pattern.at(j) == '[' || pattern.at(j) == ']')
+            expression += '\\';
+        expression += pattern.at(j++);
+    }
+    if (j >= pattern.size())
+        return QString();
+    *i = j + 1;
+    return expression + ']';
+}
+
+// a pattern of the lfs lines of the rules, as git matches it in
+// .gitattributes: * and ? do not match a slash, a leading **/ matches in
+// all directories, /**/ in zero or more directories and a trailing /**
+// matches everything below
+static QRegExp lfsPatternRegExp(const QString &pattern)
+{
+    QString glob = pattern.startsWith('/') ? pattern.mid(1) : pattern;
+    QString rx;
+    int i = 0;
+    if (glob.startsWith("**/")) {
+        rx += "(?:.*/)?";
+        i = 3;
+    }
+    while (i < glob.size()) {
+        if (glob.mid(i, 4) == "/**/") {
+            rx += "/(?:.*/)?";
+            i += 4;
+        } else if (glob.mid(i) == "/**") {
+            rx += "/.*";
+            i += 3;
+        } else if (glob.at(i) == '*') {
+            while (i < glob.size() && glob.at(i) == '*')
+                ++i;
+            rx += "[^/]*";
+        } else if (glob.at(i) == '?') {
+            rx += "[^/]";
+            ++i;
+        } else if (glob.at(i) == '[') {
+            QString expression = lfsBracketExpression(glob, &i);
+            if (expression.isEmpty())
+                rx += QRegExp::escape(glob.at(i++));
+            else
+                rx += expression;
+        } else {
+            if (glob.at(i) == '\\' && i + 1 < glob.size())
+                ++i;
+            rx += QRegExp::escape(glob.at(i++));
+        }
+    }
+    return QRegExp(rx, Qt::CaseSensitive);
+}
+
+static QString lfsAttributePath(const QByteArray &pattern)
+{
+    QByteArray path = pattern.mid(1);
+    path.replace("[[:space:]]", " ");
+    QByteArray unescaped;
+    for (int i = 0; i < path.size(); ++i) {
+        if (path.at(i) == '\\' && i + 1 < path.size())
+            ++i;
+        unescaped += path.at(i);
+    }
+    return QString::fromUtf8(unescaped);
+}
 
 class FastImportRepository : public Repository
 {
@@ -46,6 +183,7 @@ public:
     {
         Q_DISABLE_COPY(Transaction)
         friend class FastImportRepository;
+        friend class LfsObjectWriter;
 
         FastImportRepository *repository;
         QByteArray branch;
@@ -57,8 +195,39 @@ public:
 
         QVector<int> merges;
 
-        QStringList deletedFiles;
+        // file-modify and delete records, the ones that did not fit into
+        // the --transaction-memory budget are spilled to temporary files
+        bool deleteAll;
+        int modificationCount;
+        qint64 bufferedBytes;
+        QByteArray deletedFiles;
         QByteArray modifiedFiles;
+        QTemporaryFile *spilledDeletions;
+        QTemporaryFile *spilledModifications;
+        QStringList changedTrees;   // paths the records in deletedFiles replace or remove
+
+        // the files stored in Git LFS changed, .gitattributes is rewritten
+        bool lfsChanged;
+        // the .gitattributes of the svn tree was written, it stays unless
+        // the LFS files need ours
+        bool svnGitAttributes;
+
+        void buffered(qint64 bytes);
+        bool inBranchTree(const QString &pathFrom, int revFrom);
+        void spill();
+        void replay(QTemporaryFile *spilled);
+        void modifyFile(const QString &path, int mode, const QByteArray &dataref);
+        QIODevice *addBlob(const QString &path, int mode, qint64 length, mark_t mark);
+
+        bool useLfs(const QString &path, int mode, qint64 length) const;
+        QByteArray lfsContentKey(const QString &path, const QByteArray &contentKey) const;
+        QIODevice *addLfsFile(const QString &path, int mode, qint64 length, const QByteArray &contentKey);
+        void addLfsPointer(const QString &path, int mode, const QByteArray &oid, qint64 size,
+                           const QByteArray &contentKey);
+        void setLfsFile(const QString &path, bool lfs);
+        void removeLfsFiles(const QString &path);
+        void copyLfsFiles(const QString &branchFrom, const QString &pathFrom, const QString &path);
+        void writeGitAttributes();
 
         inline Transaction() {}
     public:
@@ -73,6 +242,10 @@ public:
 
         void deleteFile(const QString &path);
         QIODevice *addFile(const QString &path, int mode, qint64 length);
+        QIODevice *addFile(const QString &path, int mode, qint64 length, const QByteArray &contentKey);
+        bool reuseFile(const QString &path, int mode, const QByteArray &contentKey);
+        bool copyTree(const QString &path, const QString &branchFrom, int revFrom,
+                      const QString &pathFrom);
 
         bool commitNote(const QByteArray &noteText, bool append,
                         const QByteArray &commit = QByteArray());
@@ -98,6 +271,7 @@ public:
     void commit();
 
     bool branchExists(const QString& branch) const;
+    bool hasCommit(const QString &branch, int revnum);
     const QByteArray branchNote(const QString& branch) const;
     void setBranchNote(const QString& branch, const QByteArray& noteText);
 
@@ -137,6 +311,31 @@ private:
     /* starts at maxMark - 1 and counts down. Reset after each SVN revision */
     mark_t next_file_mark;
 
+    /* starts at maxContentMark and counts down. The blobs keep their mark
+       until fast-import is closed, contentMarks finds them by content */
+    mark_t next_content_mark;
+    QHash<QByteArray, mark_t> contentMarks;
+    QIODevice *blobCacheWriter;
+
+    /* read end of the --cat-blob-fd pipe, -1 if fast-import is not
+       running or cannot answer ls commands */
+    int catBlobFd;
+
+    /* Git LFS, with --lfs-threshold or lfs patterns in the rules: the
+       files of each branch stored as pointers, mapped to whether a pattern
+       covers them. The .gitattributes of a branch lists the patterns and
+       the other files by path. lfsContentKeys are the content keys of
+       pointer blobs */
+    bool lfs;
+    QStringList lfsPatternLines;
+    QList<QRegExp> lfsPatterns;
+    QHash<QString, QMap<QString, bool> > lfsFiles;
+    QSet<QByteArray> lfsContentKeys;
+    QIODevice *lfsWriter;
+
+    bool lfsPatternMatches(const QString &path) const;
+    QMap<QString, bool> &lfsFilesOf(const QString &branch);
+
     bool processHasStarted;
 
     void startFastImport();
@@ -147,6 +346,7 @@ private:
 
     int resetBranch(const QString &branch, int revnum, mark_t mark, const QByteArray &resetTo, const QByteArray &comment);
     long long markFrom(const QString &branchFrom, int branchRevNum, QByteArray &desc);
+    bool treeFrom(const QString &branchFrom, int branchRevNum, const QString &pathFrom, QByteArray *sha);
 
     friend class ProcessCache;
     Q_DISABLE_COPY(FastImportRepository)
@@ -179,6 +379,13 @@ public:
         void deleteFile(const QString &path) { txn->deleteFile(prefix + path); }
         QIODevice *addFile(const QString &path, int mode, qint64 length)
         { return txn->addFile(prefix + path, mode, length); }
+        QIODevice *addFile(const QString &path, int mode, qint64 length, const QByteArray &contentKey)
+        { return txn->addFile(prefix + path, mode, length, contentKey); }
+        bool reuseFile(const QString &path, int mode, const QByteArray &contentKey)
+        { return txn->reuseFile(prefix + path, mode, contentKey); }
+        bool copyTree(const QString &path, const QString &branchFrom, int revFrom,
+                      const QString &pathFrom)
+        { return txn->copyTree(prefix + path, branchFrom, revFrom, prefix + pathFrom); }
 
         bool commitNote(const QByteArray &noteText, bool append,
                         const QByteArray &commit)
@@ -216,6 +423,8 @@ public:
 
     bool branchExists(const QString& branch) const
     { return repo->branchExists(branch); }
+    bool hasCommit(const QString &branch, int revnum)
+    { return repo->hasCommit(branch, revnum); }
     const QByteArray branchNote(const QString& branch) const
     { return repo->branchNote(branch); }
     void setBranchNote(const QString& branch, const QByteArray& noteText)
@@ -256,6 +465,246 @@ public:
 };
 static ProcessCache processCache;
 
+/*
+ * Blobs of earlier runs, kept in the bare repository given with
+ * --blob-cache. The output repositories borrow its objects through
+ * objects/info/alternates, so files whose SVN SHA-1 is in the map are
+ * written as an M line with the git SHA-1 and their contents are neither
+ * read nor sent to fast-import again. The map file holds records of the
+ * 20 byte SVN SHA-1 followed by the 20 byte git SHA-1.
+ */
+class BlobCache
+{
+public:
+    // blobs larger than this are not cached, they are kept in memory until
+    // they have been written
+    static const qint64 maxBlobSize = 16 * 1024 * 1024;
+
+    // null without --blob-cache
+    static BlobCache *instance();
+
+    bool find(const QByteArray &contentKey, QByteArray *sha) const;
+    void store(const QByteArray &contentKey, const QByteArray &contents);
+    void addAlternate(const QString &repository);
+
+private:
+    BlobCache(const QString &path);
+
+    static const int keySize = 20;
+
+    QDir dir;
+    QFile map;
+    QHash<QByteArray, QByteArray> shas;
+};
+
+BlobCache *BlobCache::instance()
+{
+    static BlobCache *cache = 0;
+    static bool initialized = false;
+    if (!initialized) {
+        initialized = true;
+        // with --lfs-threshold the size decides between a blob and a pointer
+        if (CommandLineParser::instance()->contains("blob-cache")
+                && !CommandLineParser::instance()->contains("lfs-threshold")
+                && !CommandLineParser::instance()->contains("dry-run")
+                && !CommandLineParser::instance()->contains("create-dump"))
+            cache = new BlobCache(CommandLineParser::instance()->optionArgument("blob-cache"));
+    }
+    return cache;
+}
+
+BlobCache::BlobCache(const QString &path)
+    : dir(QDir(path).absolutePath())
+{
+    if (!dir.exists("objects")) {
+        qDebug() << "Creating blob cache" << dir.path();
+        QDir::current().mkpath(dir.path());
+        QProcess init;
+        init.setWorkingDirectory(dir.path());
+        init.start("git", QStringList() << "--bare" << "init");
+        init.waitForFinished(-1);
+    }
+
+    map.setFileName(dir.filePath("svn-blobs"));
+    if (!map.open(QIODevice::ReadWrite)) {
+        qWarning() << "WARN: Cannot open" << map.fileName() << ", blobs are not cached";
+        return;
+    }
+    QByteArray records = map.readAll();
+    int count = records.size() / (2 * keySize);
+    for (int i = 0; i < count; ++i) {
+        const char *record = records.constData() + i * 2 * keySize;
+        shas.insert(QByteArray(record, keySize), QByteArray(record + keySize, keySize).toHex());
+    }
+    // drop a record that was cut off
+    map.resize(qint64(count) * 2 * keySize);
+    map.seek(map.size());
+    printf("Blob cache %s knows %d blobs\n", qPrintable(dir.path()), shas.size());
+}
+
+bool BlobCache::find(const QByteArray &contentKey, QByteArray *sha) const
+{
+    QHash<QByteArray, QByteArray>::ConstIterator it = shas.constFind(contentKey);
+    if (it == shas.constEnd())
+        return false;
+    *sha = it.value();
+    return true;
+}
+
+void BlobCache::store(const QByteArray &contentKey, const QByteArray &contents)
+{
+    if (!map.isOpen() || contentKey.size() != keySize || shas.contains(contentKey))
+        return;
+
+    QByteArray object = "blob " + QByteArray::number(contents.size()) + '\0' + contents;
+    QByteArray sha = QCryptographicHash::hash(object, QCryptographicHash::Sha1);
+    QByteArray hex = sha.toHex();
+
+    // a loose object, git gc in the cache directory may pack them
+    QString objectDir = dir.filePath("objects/" + QString::fromLatin1(hex.left(2)));
+    QString objectPath = objectDir + "/" + QString::fromLatin1(hex.mid(2));
+    if (!QFile::exists(objectPath)) {
+        QDir().mkpath(objectDir);
+        QSaveFile file(objectPath);
+        // qCompress puts the uncompressed size in front of the zlib stream
+        if (!file.open(QIODevice::WriteOnly) || file.write(qCompress(object).mid(4)) < 0 || !file.commit()) {
+            qWarning() << "WARN: Cannot write" << objectPath << ", the blob is not cached";
+            return;
+        }
+    }
+
+    if (map.write(contentKey) != keySize || map.write(sha) != keySize || !map.flush()) {
+        qWarning() << "WARN: Cannot write" << map.fileName() << ", blobs are not cached";
+        map.close();
+        return;
+    }
+    shas.insert(contentKey, hex);
+}
+
+void BlobCache::addAlternate(const QString &repository)
+{
+    QString objects = dir.filePath("objects");
+    QFile alternates(repository + "/objects/info/alternates");
+    if (alternates.open(QIODevice::ReadOnly)) {
+        foreach (const QByteArray &line, alternates.readAll().split('\n')) {
+            if (QFile::decodeName(line.trimmed()) == objects)
+                return;
+        }
+        alternates.close();
+    }
+    QDir().mkpath(repository + "/objects/info");
+    if (!alternates.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCritical() << "Cannot add the blob cache to" << alternates.fileName();
+        exit(1);
+    }
+    alternates.write(QFile::encodeName(objects) + '\n');
+}
+
+// passes a blob on to fast-import and stores it in the blob cache once it
+// has been written completely
+class BlobCacheWriter : public QIODevice
+{
+public:
+    BlobCacheWriter(QIODevice *t, const QByteArray &key, qint64 l)
+        : target(t), contentKey(key), length(l)
+    {
+        open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+        contents.reserve(length);
+        if (length == 0)
+            BlobCache::instance()->store(contentKey, contents);
+    }
+
+    // the writes pile up in the buffer of fast-import's process, not here
+    qint64 bytesToWrite() const { return target->bytesToWrite(); }
+    bool waitForBytesWritten(int msecs) { return target->waitForBytesWritten(msecs); }
+
+protected:
+    qint64 readData(char *, qint64) { return -1; }
+    qint64 writeData(const char *data, qint64 len)
+    {
+        qint64 missing = length - contents.size();
+        if (missing > 0) {
+            contents.append(data, int(qMin(len, missing)));
+            if (contents.size() == length) {
+                BlobCache::instance()->store(contentKey, contents);
+                contents = QByteArray();
+            }
+        }
+        return target->write(data, len);
+    }
+
+private:
+    QIODevice *target;
+    QByteArray contentKey;
+    qint64 length;
+    QByteArray contents;
+};
+
+/*
+ * Stores the contents of a file in the Git LFS object store of the
+ * repository while they are written, hashing them with SHA-256 on the
+ * way. Once they are complete, only the pointer blob goes to fast-import.
+ */
+class LfsObjectWriter : public QIODevice
+{
+public:
+    LfsObjectWriter(FastImportRepository::Transaction *t, const QString &objects, const QString &p,
+                    int m, qint64 l, const QByteArray &key)
+        : txn(t), objectsDir(objects), path(p), mode(m), length(l), written(0), contentKey(key),
+          hash(QCryptographicHash::Sha256), file(objects + "/tmp/object-XXXXXX")
+    {
+        open(QIODevice::WriteOnly | QIODevice::Unbuffered);
+        QDir().mkpath(objectsDir + "/tmp");
+        if (!file.open())
+            qFatal("Failed to create a temporary file: %s", qPrintable(file.errorString()));
+    }
+
+protected:
+    qint64 readData(char *, qint64) { return -1; }
+    qint64 writeData(const char *data, qint64 len)
+    {
+        // the newline after the contents is not part of them
+        qint64 missing = length - written;
+        if (missing > 0) {
+            qint64 n = qMin(len, missing);
+            hash.addData(data, int(n));
+            if (file.write(data, n) != n)
+                qFatal("Failed to write to %s: %s", qPrintable(file.fileName()), qPrintable(file.errorString()));
+            written += n;
+            if (written == length)
+                finish();
+        }
+        return len;
+    }
+
+private:
+    void finish()
+    {
+        QByteArray oid = hash.result().toHex();
+        QString dir = objectsDir + '/' + oid.left(2) + '/' + oid.mid(2, 2);
+        QString objectPath = dir + '/' + oid;
+        if (QFile::exists(objectPath)) {
+            file.close();
+        } else {
+            QDir().mkpath(dir);
+            if (!file.rename(objectPath))
+                qFatal("Failed to store %s: %s", qPrintable(objectPath), qPrintable(file.errorString()));
+            file.setAutoRemove(false);
+        }
+        txn->addLfsPointer(path, mode, oid, length, contentKey);
+    }
+
+    FastImportRepository::Transaction *txn;
+    QString objectsDir;
+    QString path;
+    int mode;
+    qint64 length;
+    qint64 written;
+    QByteArray contentKey;
+    QCryptographicHash hash;
+    QTemporaryFile file;
+};
+
 QDataStream &operator<<(QDataStream &out, const FastImportRepository::AnnotatedTag &annotatedTag)
 {
     out << annotatedTag.supportingRef
@@ -318,8 +767,13 @@ static QString branchNotesFileName(QString name)
 
 FastImportRepository::FastImportRepository(const Rules::Repository &rule)
     : name(rule.name), prefix(rule.forwardTo), fastImport(name), commitCount(0), outstandingTransactions(0),
-      last_commit_mark(0), next_file_mark(maxMark - 1), processHasStarted(false)
+      last_commit_mark(0), next_file_mark(maxMark - 1), next_content_mark(maxContentMark),
+      blobCacheWriter(0), catBlobFd(-1), lfsPatternLines(rule.lfsPatterns), lfsWriter(0), processHasStarted(false)
 {
+    foreach (const QString &pattern, lfsPatternLines)
+        lfsPatterns << lfsPatternRegExp(pattern);
+    lfs = (lfsThreshold() > 0 || !lfsPatterns.isEmpty()) && !CommandLineParser::instance()->contains("dry-run");
+
     foreach (Rules::Repository::Branch branchRule, rule.branches) {
         Branch branch;
         branch.created = 1;
@@ -368,6 +822,8 @@ FastImportRepository::FastImportRepository(const Rules::Repository &rule)
                 marks.close();
             }
         }
+        if (BlobCache::instance())
+            BlobCache::instance()->addAlternate(name);
     }
 }
 
@@ -546,6 +1002,8 @@ FastImportRepository::~FastImportRepository()
 {
     Q_ASSERT(outstandingTransactions == 0);
     closeFastImport();
+    delete blobCacheWriter;
+    delete lfsWriter;
 }
 
 void FastImportRepository::closeFastImport()
@@ -568,8 +1026,15 @@ void FastImportRepository::closeFastImport()
                 qWarning() << "WARN: git-fast-import for repository" << name << "did not die";
         }
     }
+    if (catBlobFd >= 0) {
+        ::close(catBlobFd);
+        catBlobFd = -1;
+    }
     processHasStarted = false;
     processCache.remove(this);
+    contentMarks.clear();
+    lfsContentKeys.clear();
+    next_content_mark = maxContentMark;
 }
 
 void FastImportRepository::reloadBranches()
@@ -661,12 +1126,20 @@ int FastImportRepository::createBranch(const QString &branch, int revnum,
     // Preserve note
     branchNotes[branch] = branchNotes.value(branchFrom);
 
+    // the branch starts out with the .gitattributes of branchFrom
+    if (lfs) {
+        QMap<QString, bool> files = lfsFilesOf(branchFrom);
+        lfsFiles.insert(branch, files);
+    }
+
     return resetBranch(branch, revnum, mark, branchFromRef, branchFromDesc);
 }
 
 int FastImportRepository::deleteBranch(const QString &branch, int revnum)
 {
     static QByteArray null_sha(40, '0');
+    if (lfs)
+        lfsFiles.insert(branch, QMap<QString, bool>());
     return resetBranch(branch, revnum, 0, null_sha, "delete");
 }
 
@@ -747,6 +1220,13 @@ Repository::Transaction *FastImportRepository::newTransaction(const QString &bra
     txn->svnprefix = svnprefix.toUtf8();
     txn->datetime = 0;
     txn->revnum = revnum;
+    txn->deleteAll = false;
+    txn->modificationCount = 0;
+    txn->bufferedBytes = 0;
+    txn->spilledDeletions = 0;
+    txn->spilledModifications = 0;
+    txn->lfsChanged = false;
+    txn->svnGitAttributes = false;
 
     if ((++commitCount % CommandLineParser::instance()->optionArgument(QLatin1String("commit-interval"), QLatin1String("10000")).toInt()) == 0) {
         startFastImport();
@@ -906,17 +1386,148 @@ void FastImportRepository::startFastImport()
         fastImport.setStandardOutputFile(logFileName(name), QIODevice::Append);
         fastImport.setProcessChannelMode(QProcess::MergedChannels);
 
+        // the answers to ls commands come back through a pipe of their own,
+        // stdout goes to the log file
+        int catBlobPipe[2] = { -1, -1 };
         if (!CommandLineParser::instance()->contains("dry-run") && !CommandLineParser::instance()->contains("create-dump")) {
+            if (::pipe(catBlobPipe) == 0) {
+                ::fcntl(catBlobPipe[0], F_SETFD, FD_CLOEXEC);
+                marksOptions << "--cat-blob-fd=" + QString::number(catBlobPipe[1]);
+            } else {
+                qWarning("WARN: cannot create a pipe for git-fast-import: %s", strerror(errno));
+            }
             fastImport.start("git", QStringList() << "fast-import" << marksOptions);
         } else {
             fastImport.start("cat", QStringList());
         }
         fastImport.waitForStarted(-1);
+        if (catBlobPipe[1] >= 0)
+            ::close(catBlobPipe[1]);
+        catBlobFd = catBlobPipe[0];
 
         reloadBranches();
     }
 }
 
+bool FastImportRepository::lfsPatternMatches(const QString &path) const
+{
+    QString fileName = path.mid(path.lastIndexOf('/') + 1);
+    for (int i = 0; i < lfsPatterns.size(); ++i) {
+        // as in .gitattributes, a pattern without a slash matches the file name
+        if (lfsPatterns.at(i).exactMatch(lfsPatternLines.at(i).contains('/') ? path : fileName))
+            return true;
+    }
+    return false;
+}
+
+QMap<QString, bool> &FastImportRepository::lfsFilesOf(const QString &branch)
+{
+    QHash<QString, QMap<QString, bool> >::Iterator it = lfsFiles.find(branch);
+    if (it != lfsFiles.end())
+        return it.value();
+
+    // a branch of an earlier run, the files no pattern covers are listed
+    // in its .gitattributes
+    QMap<QString, bool> files;
+    QString branchRef = branch;
+    if (!branchRef.startsWith("refs/"))
+        branchRef.prepend("refs/heads/");
+    QProcess attributes;
+    attributes.setWorkingDirectory(name);
+    attributes.start("git", QStringList() << "cat-file" << "blob" << branchRef + ":.gitattributes");
+    attributes.waitForFinished(-1);
+    if (attributes.exitStatus() != QProcess::NormalExit || attributes.exitCode() != 0)
+        return lfsFiles.insert(branch, files).value();
+    foreach (const QByteArray &line, attributes.readAllStandardOutput().split('\n')) {
+        if (line.startsWith('/') && line.endsWith(lfsAttributes))
+            files.insert(lfsAttributePath(line.left(line.size() - int(strlen(lfsAttributes)))), false);
+    }
+
+    // and the ones the patterns cover are found in its tree
+    if (!lfsPatterns.isEmpty()) {
+        QProcess tree;
+        tree.setWorkingDirectory(name);
+        tree.start("git", QStringList() << "ls-tree" << "-r" << "-z" << "--full-tree" << branchRef);
+        tree.waitForFinished(-1);
+        foreach (const QByteArray &entry, tree.readAllStandardOutput().split('\0')) {
+            // <mode> SP <type> SP <object> TAB <path>
+            int tab = entry.indexOf('\t');
+            if (tab < 0 || !(entry.startsWith("100644 ") || entry.startsWith("100755 ")))
+                continue;
+            QString path = QString::fromUtf8(entry.mid(tab + 1));
+            if (lfsPatternMatches(path))
+                files.insert(path, true);
+        }
+    }
+    return lfsFiles.insert(branch, files).value();
+}
+
+// a path of a C command or of a tree, which must be quoted if it has
+// spaces or is the empty path of the root
+static QByteArray quotedPath(const QString &path)
+{
+    QByteArray utf8 = path.toUtf8();
+    if (!utf8.isEmpty() && !utf8.startsWith('"') && !utf8.contains(' ')
+            && !utf8.contains('\\') && !utf8.contains('\n'))
+        return utf8;
+
+    QByteArray quoted = "\"";
+    foreach (char c, utf8) {
+        if (c == '"' || c == '\\')
+            quoted += '\\';
+        if (c == '\n')
+            quoted += "\\n";
+        else
+            quoted += c;
+    }
+    return quoted + '"';
+}
+
+bool FastImportRepository::treeFrom(const QString &branchFrom, int branchRevNum, const QString &pathFrom,
+                                    QByteArray *sha)
+{
+    QString pathNoSlash = pathFrom;
+    if (pathNoSlash.endsWith('/'))
+        pathNoSlash.chop(1);
+
+    QByteArray desc;
+    long long mark = markFrom(branchFrom, branchRevNum, desc);
+    if (mark <= 0)
+        return false;
+
+    startFastImport();
+    if (catBlobFd < 0)
+        return false;
+
+    fastImport.write("ls :" + QByteArray::number(mark) + " " + quotedPath(pathNoSlash) + "\n");
+    while (fastImport.bytesToWrite())
+        if (!fastImport.waitForBytesWritten(-1))
+            qFatal("Failed to write to process: %s for repository %s", qPrintable(fastImport.errorString()), qPrintable(name));
+
+    // either "040000 tree <sha1>\t<path>" or "missing <path>"
+    QByteArray answer;
+    for (;;) {
+        char c;
+        ssize_t n = ::read(catBlobFd, &c, 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            qWarning() << "WARN: git-fast-import for repository" << name << "did not answer ls";
+            ::close(catBlobFd);
+            catBlobFd = -1;
+            return false;
+        }
+        if (c == '\n')
+            break;
+        answer.append(c);
+    }
+
+    if (!answer.startsWith("040000 tree "))
+        return false;
+    *sha = answer.mid(12, 40);
+    return true;
+}
+
 QByteArray Repository::formatMetadataMessage(const QByteArray &svnprefix, int revnum, const QByteArray &tag)
 {
     QByteArray msg = "svn path=" + svnprefix + "; revision=" + QByteArray::number(revnum);
@@ -931,6 +1542,12 @@ bool FastImportRepository::branchExists(const QString& branch) const
     return branches.contains(branch);
 }
 
+bool FastImportRepository::hasCommit(const QString &branch, int revnum)
+{
+    QByteArray desc;
+    return branches.contains(branch) && markFrom(branch, revnum, desc) > 0;
+}
+
 const QByteArray FastImportRepository::branchNote(const QString& branch) const
 {
     return branchNotes.value(branch);
@@ -957,11 +1574,90 @@ Repository *FastImportRepository::getEffectiveRepository()
     return this;
 }
 
+// bytes of file-modify and delete records held in memory by all open transactions
+static qint64 transactionBytes = 0;
+static qint64 peakTransactionBytes = 0;
+static QSet<FastImportRepository::Transaction *> bufferingTransactions;
+
+static qint64 transactionMemoryLimit()
+{
+    static const qint64 limit = CommandLineParser::instance()->contains("transaction-memory")
+        ? CommandLineParser::instance()->optionArgument("transaction-memory").toLongLong() * 1024 * 1024
+        : -1;
+    return limit;
+}
+
+qint64 Repository::takePeakBufferedRecordBytes()
+{
+    qint64 peak = peakTransactionBytes;
+    peakTransactionBytes = transactionBytes;
+    return peak;
+}
+
 FastImportRepository::Transaction::~Transaction()
 {
+    transactionBytes -= bufferedBytes;
+    bufferingTransactions.remove(this);
+    delete spilledDeletions;
+    delete spilledModifications;
     repository->forgetTransaction(this);
 }
 
+void FastImportRepository::Transaction::buffered(qint64 bytes)
+{
+    bufferedBytes += bytes;
+    transactionBytes += bytes;
+    bufferingTransactions.insert(this);
+    if (transactionBytes > peakTransactionBytes)
+        peakTransactionBytes = transactionBytes;
+
+    // spilling only this transaction could leave the total above the limit,
+    // then every further record would be written out on its own
+    qint64 limit = transactionMemoryLimit();
+    if (limit >= 0 && transactionBytes > limit) {
+        foreach (Transaction *txn, bufferingTransactions)
+            txn->spill();
+        bufferingTransactions.clear();
+    }
+}
+
+static void spillTo(QTemporaryFile **spilled, QByteArray *records)
+{
+    if (records->isEmpty())
+        return;
+    if (!*spilled) {
+        *spilled = new QTemporaryFile(QDir::tempPath() + "/svn2git-transaction-XXXXXX");
+        if (!(*spilled)->open())
+            qFatal("Failed to create a temporary file: %s", qPrintable((*spilled)->errorString()));
+    }
+    if ((*spilled)->write(*records) != records->size())
+        qFatal("Failed to write to %s: %s", qPrintable((*spilled)->fileName()),
+               qPrintable((*spilled)->errorString()));
+    records->clear();
+}
+
+void FastImportRepository::Transaction::spill()
+{
+    spillTo(&spilledDeletions, &deletedFiles);
+    spillTo(&spilledModifications, &modifiedFiles);
+    transactionBytes -= bufferedBytes;
+    bufferedBytes = 0;
+}
+
+void FastImportRepository::Transaction::replay(QTemporaryFile *spilled)
+{
+    if (!spilled)
+        return;
+    spilled->flush();
+    spilled->seek(0);
+    while (!spilled->atEnd()) {
+        repository->fastImport.write(spilled->read(1024 * 1024));
+        while (repository->fastImport.bytesToWrite() > 1024 * 1024)
+            if (!repository->fastImport.waitForBytesWritten(-1))
+                qFatal("Failed to write to process: %s for repository %s", qPrintable(repository->fastImport.errorString()), qPrintable(repository->name));
+    }
+}
+
 void FastImportRepository::Transaction::setAuthor(const QByteArray &a)
 {
     author = a;
@@ -1010,25 +1706,319 @@ void FastImportRepository::Transaction::deleteFile(const QString &path)
     QString pathNoSlash = repository->prefix + path;
     if(pathNoSlash.endsWith('/'))
         pathNoSlash.chop(1);
-    deletedFiles.append(pathNoSlash);
+    ++modificationCount;
+    if (pathNoSlash.isEmpty()) {
+        // the deletions and copies before do not matter anymore
+        deleteAll = true;
+        bufferedBytes -= deletedFiles.size();
+        transactionBytes -= deletedFiles.size();
+        deletedFiles.clear();
+        delete spilledDeletions;
+        spilledDeletions = 0;
+        changedTrees.clear();
+        removeLfsFiles(pathNoSlash);
+        return;
+    }
+
+    QByteArray record = "D " + pathNoSlash.toUtf8() + "\n";
+    deletedFiles.append(record);
+    changedTrees.append(pathNoSlash);
+    removeLfsFiles(pathNoSlash);
+    buffered(record.size());
 }
 
 QIODevice *FastImportRepository::Transaction::addFile(const QString &path, int mode, qint64 length)
 {
+    if (useLfs(path, mode, length))
+        return addLfsFile(path, mode, length, QByteArray());
+    setLfsFile(path, false);
+
     mark_t mark = repository->next_file_mark--;
 
+    // in case the two mark allocations meet, we might as well just abort
+    Q_ASSERT(mark > maxContentMark);
+
+    return addBlob(path, mode, length, mark);
+}
+
+QIODevice *FastImportRepository::Transaction::addFile(const QString &path, int mode, qint64 length,
+                                                      const QByteArray &contentKey)
+{
+    QByteArray key = lfsContentKey(path, contentKey);
+    if (useLfs(path, mode, length))
+        return addLfsFile(path, mode, length, key);
+
+    // the table is kept in memory, past the limit the blobs are not shared
+    if (repository->contentMarks.size() >= maxContentMarks)
+        return addFile(path, mode, length);
+    setLfsFile(path, false);
+
+    mark_t mark = repository->next_content_mark--;
+
     // in case the two mark allocations meet, we might as well just abort
     Q_ASSERT(mark > repository->last_commit_mark + 1);
 
+    repository->contentMarks.insert(key, mark);
+    QIODevice *io = addBlob(path, mode, length, mark);
+    if (BlobCache::instance() && key == contentKey && length <= BlobCache::maxBlobSize) {
+        delete repository->blobCacheWriter;
+        repository->blobCacheWriter = new BlobCacheWriter(io, contentKey, length);
+        return repository->blobCacheWriter;
+    }
+    return io;
+}
+
+bool FastImportRepository::Transaction::reuseFile(const QString &path, int mode, const QByteArray &contentKey)
+{
+    QByteArray key = lfsContentKey(path, contentKey);
+    QHash<QByteArray, mark_t>::ConstIterator it = repository->contentMarks.constFind(key);
+
+    if (it != repository->contentMarks.constEnd()) {
+        modifyFile(path, mode, ":" + QByteArray::number(it.value()));
+        setLfsFile(path, repository->lfsContentKeys.contains(key));
+        return true;
+    }
+
+    QByteArray sha;
+    if (BlobCache::instance() && key == contentKey && BlobCache::instance()->find(contentKey, &sha)) {
+        modifyFile(path, mode, sha);
+        setLfsFile(path, false);
+        return true;
+    }
+    return false;
+}
+
+bool FastImportRepository::Transaction::copyTree(const QString &path, const QString &branchFrom, int revFrom,
+                                                const QString &pathFrom)
+{
+    QString pathNoSlash = repository->prefix + path;
+    if (pathNoSlash.endsWith('/'))
+        pathNoSlash.chop(1);
+    QString pathFromNoSlash = repository->prefix + pathFrom;
+    if (pathFromNoSlash.endsWith('/'))
+        pathFromNoSlash.chop(1);
+
+    QByteArray record;
+    if (branchFrom == branch && !pathNoSlash.isEmpty() && !pathFromNoSlash.isEmpty()
+            && inBranchTree(pathFromNoSlash, revFrom)) {
+        record = "C " + quotedPath(pathFromNoSlash) + " " + quotedPath(pathNoSlash) + "\n";
+    } else {
+        QByteArray sha;
+        if (!repository->treeFrom(branchFrom, revFrom, pathFromNoSlash, &sha))
+            return false;
+        record = "M 040000 " + sha + " " + quotedPath(pathNoSlash) + "\n";
+    }
+
+    // kept with the deletions so that the ones below path come after it
+    deletedFiles.append(record);
+    changedTrees.append(pathNoSlash);
+    copyLfsFiles(branchFrom, pathFromNoSlash, pathNoSlash);
+    ++modificationCount;
+    buffered(record.size());
+    return true;
+}
+
+// whether pathFrom@revFrom is still in the tree the commit starts from,
+// that C commands copy from: the branch has no later commits, and the
+// records so far left pathFrom alone
+bool FastImportRepository::Transaction::inBranchTree(const QString &pathFrom, int revFrom)
+{
+    if (deleteAll)
+        return false;
+
+    const Branch &br = repository->branches.value(branch);
+    QByteArray desc;
+    if (!br.created || br.marks.isEmpty() || br.marks.last() <= 0
+            || repository->markFrom(branch, revFrom, desc) != br.marks.last())
+        return false;
+
+    foreach (const QString &changed, changedTrees) {
+        if (changed.isEmpty() || changed == pathFrom || changed.startsWith(pathFrom + '/')
+                || pathFrom.startsWith(changed + '/'))
+            return false;
+    }
+    return true;
+}
+
+bool FastImportRepository::Transaction::useLfs(const QString &path, int mode, qint64 length) const
+{
+    if (!repository->lfs || mode == 0120000 || length == 0)
+        return false;
+
+    qint64 threshold = lfsThreshold();
+    return (threshold > 0 && length >= threshold) || repository->lfsPatternMatches(repository->prefix + path);
+}
+
+// the same contents are a blob or a pointer depending on the lfs
+// patterns, the size decides the same way for both
+QByteArray FastImportRepository::Transaction::lfsContentKey(const QString &path, const QByteArray &contentKey) const
+{
+    if (repository->lfs && repository->lfsPatternMatches(repository->prefix + path))
+        return contentKey + 'L';
+    return contentKey;
+}
+
+QIODevice *FastImportRepository::Transaction::addLfsFile(const QString &path, int mode, qint64 length,
+                                                         const QByteArray &contentKey)
+{
+    delete repository->lfsWriter;
+    repository->lfsWriter = new LfsObjectWriter(this, repository->name + "/lfs/objects", path, mode, length,
+                                                contentKey);
+    return repository->lfsWriter;
+}
+
+void FastImportRepository::Transaction::addLfsPointer(const QString &path, int mode, const QByteArray &oid,
+                                                      qint64 size, const QByteArray &contentKey)
+{
+    QByteArray pointer = "version https://git-lfs.github.com/spec/v1\n"
+                         "oid sha256:" + oid + "\n"
+                         "size " + QByteArray::number(size) + "\n";
+
+    mark_t mark;
+    if (!contentKey.isEmpty() && repository->contentMarks.size() < maxContentMarks) {
+        mark = repository->next_content_mark--;
+        Q_ASSERT(mark > repository->last_commit_mark + 1);
+        repository->contentMarks.insert(contentKey, mark);
+        repository->lfsContentKeys.insert(contentKey);
+    } else {
+        mark = repository->next_file_mark--;
+        Q_ASSERT(mark > maxContentMark);
+    }
+
+    QIODevice *io = addBlob(path, mode, pointer.size(), mark);
+    io->write(pointer);
+    io->putChar('\n');
+    setLfsFile(path, true);
+    Stats::instance()->count("LFS object bytes", size);
+}
+
+void FastImportRepository::Transaction::setLfsFile(const QString &path, bool lfs)
+{
+    if (!repository->lfs)
+        return;
+
+    QString fullPath = repository->prefix + path;
+    if (fullPath == ".gitattributes") {
+        // it replaces ours
+        svnGitAttributes = true;
+        lfsChanged = true;
+    }
+
+    QMap<QString, bool> &files = repository->lfsFilesOf(branch);
+    if (lfs) {
+        bool covered = repository->lfsPatternMatches(fullPath);
+        QMap<QString, bool>::ConstIterator it = files.constFind(fullPath);
+        if (it == files.constEnd() || it.value() != covered) {
+            files.insert(fullPath, covered);
+            lfsChanged = true;
+        }
+    } else if (files.remove(fullPath)) {
+        lfsChanged = true;
+    }
+}
+
+// forgets the files at or below path, which has the prefix already
+void FastImportRepository::Transaction::removeLfsFiles(const QString &path)
+{
+    if (!repository->lfs)
+        return;
+
+    QMap<QString, bool> &files = repository->lfsFilesOf(branch);
+    if (files.isEmpty())
+        return;
+    if (path == ".gitattributes")
+        lfsChanged = true;
+    if (path.isEmpty()) {
+        files.clear();
+        lfsChanged = true;
+        return;
+    }
+
+    if (files.remove(path))
+        lfsChanged = true;
+    QString dir = path + '/';
+    QMap<QString, bool>::Iterator it = files.lowerBound(dir);
+    while (it != files.end() && it.key().startsWith(dir)) {
+        it = files.erase(it);
+        lfsChanged = true;
+    }
+}
+
+// the files below pathFrom in branchFrom are now below path, both have
+// the prefix already
+void FastImportRepository::Transaction::copyLfsFiles(const QString &branchFrom, const QString &pathFrom,
+                                                     const QString &path)
+{
+    if (!repository->lfs)
+        return;
+
+    removeLfsFiles(path);
+
+    QMap<QString, bool> copied;
+    QString dirFrom = pathFrom.isEmpty() ? QString() : pathFrom + '/';
+    QString dir = path.isEmpty() ? QString() : path + '/';
+    const QMap<QString, bool> &from = repository->lfsFilesOf(branchFrom);
+    for (QMap<QString, bool>::ConstIterator it = from.lowerBound(dirFrom);
+         it != from.constEnd() && it.key().startsWith(dirFrom); ++it) {
+        QString target = dir + it.key().mid(dirFrom.size());
+        copied.insert(target, repository->lfsPatternMatches(target));
+    }
+    if (copied.isEmpty())
+        return;
+
+    QMap<QString, bool> &files = repository->lfsFilesOf(branch);
+    for (QMap<QString, bool>::ConstIterator it = copied.constBegin(); it != copied.constEnd(); ++it)
+        files.insert(it.key(), it.value());
+    lfsChanged = true;
+}
+
+void FastImportRepository::Transaction::writeGitAttributes()
+{
+    const QMap<QString, bool> &files = repository->lfsFilesOf(branch);
+    QByteArray attributes;
+    if (!files.isEmpty()) {
+        foreach (const QString &pattern, repository->lfsPatternLines)
+            attributes += pattern.toUtf8() + lfsAttributes + '\n';
+        for (QMap<QString, bool>::ConstIterator it = files.constBegin(); it != files.constEnd(); ++it) {
+            if (!it.value())
+                attributes += lfsAttributePattern(it.key()) + lfsAttributes + '\n';
+        }
+    }
+
+    if (attributes.isEmpty() && svnGitAttributes)
+        return;
+
+    int size = modifiedFiles.size();
+    if (attributes.isEmpty()) {
+        modifiedFiles.append("D .gitattributes\n");
+    } else {
+        modifiedFiles.append("M 100644 inline .gitattributes\ndata " + QByteArray::number(attributes.size()) + "\n");
+        modifiedFiles.append(attributes);
+        modifiedFiles.append("\n");
+    }
+    ++modificationCount;
+    buffered(modifiedFiles.size() - size);
+}
+
+void FastImportRepository::Transaction::modifyFile(const QString &path, int mode, const QByteArray &dataref)
+{
     if (modifiedFiles.capacity() == 0)
         modifiedFiles.reserve(2048);
+    int size = modifiedFiles.size();
     modifiedFiles.append("M ");
     modifiedFiles.append(QByteArray::number(mode, 8));
-    modifiedFiles.append(" :");
-    modifiedFiles.append(QByteArray::number(mark));
+    modifiedFiles.append(' ');
+    modifiedFiles.append(dataref);
     modifiedFiles.append(' ');
     modifiedFiles.append(repository->prefix.toUtf8() + path.toUtf8());
     modifiedFiles.append("\n");
+    ++modificationCount;
+    buffered(modifiedFiles.size() - size);
+}
+
+QIODevice *FastImportRepository::Transaction::addBlob(const QString &path, int mode, qint64 length, mark_t mark)
+{
+    modifyFile(path, mode, ":" + QByteArray::number(mark));
 
     // it is returned for being written to, so start the process in any case
     repository->startFastImport();
@@ -1110,13 +2100,16 @@ int FastImportRepository::Transaction::commit()
 
     repository->startFastImport();
 
+    if (lfsChanged)
+        writeGitAttributes();
+
     // We might be tempted to use the SVN revision number as the fast-import commit mark.
     // However, a single SVN revision can modify multiple branches, and thus lead to multiple
     // commits in the same repo.  So, we need to maintain a separate commit mark counter.
     mark_t  mark = ++repository->last_commit_mark;
 
     // in case the two mark allocations meet, we might as well just abort
-    Q_ASSERT(mark < repository->next_file_mark - 1);
+    Q_ASSERT(mark < repository->next_content_mark - 1);
 
     // create the commit message
     QByteArray message = log;
@@ -1190,13 +2183,13 @@ int FastImportRepository::Transaction::commit()
         }
     }
     // write the file deletions
-    if (deletedFiles.contains(""))
+    if (deleteAll)
         repository->fastImport.write("deleteall\n");
-    else
-        foreach (QString df, deletedFiles)
-            repository->fastImport.write("D " + df.toUtf8() + "\n");
+    replay(spilledDeletions);
+    repository->fastImport.write(deletedFiles);
 
     // write the file modifications
+    replay(spilledModifications);
     repository->fastImport.write(modifiedFiles);
 
     repository->fastImport.write("\nprogress SVN r" + QByteArray::number(revnum)
@@ -1204,7 +2197,7 @@ int FastImportRepository::Transaction::commit()
                                  + (desc.isEmpty() ? "" : " # merge from") + desc
                                  + "\n\n");
     printf(" %d modifications from SVN %s to %s/%s",
-           deletedFiles.count() + modifiedFiles.count('\n'), svnprefix.data(),
+           modificationCount, svnprefix.data(),
            qPrintable(repository->name), branch.data());
 
     // Commit metadata note if requested
@@ -111,6 +111,18 @@ public:
 
         virtual void deleteFile(const QString &path) = 0;
         virtual QIODevice *addFile(const QString &path, int mode, qint64 length) = 0;
+        // as above, and the blob can be reused under contentKey by reuseFile()
+        // for as long as the fast-import process runs
+        virtual QIODevice *addFile(const QString &path, int mode, qint64 length,
+                                   const QByteArray &contentKey) = 0;
+        // returns false if no blob was added under contentKey
+        virtual bool reuseFile(const QString &path, int mode, const QByteArray &contentKey) = 0;
+        // replaces path by the directory pathFrom of the last commit on
+        // branchFrom up to revFrom, without sending its files again. Returns
+        // false if the tree is not available from fast-import. Deletions of
+        // paths below path made afterwards are applied to the copy.
+        virtual bool copyTree(const QString &path, const QString &branchFrom, int revFrom,
+                              const QString &pathFrom) = 0;
 
         virtual bool commitNote(const QByteArray &noteText, bool append,
                                 const QByteArray &commit = QByteArray()) = 0;
@@ -134,10 +146,16 @@ public:
     virtual void saveBranchNotes() = 0;
     virtual void commit() = 0;
 
+    // the most bytes of file records buffered by open transactions since the
+    // last call, not counting the spare capacity of the buffers
+    static qint64 takePeakBufferedRecordBytes();
     static QByteArray formatMetadataMessage(const QByteArray &svnprefix, int revnum,
                                             const QByteArray &tag = QByteArray());
 
     virtual bool branchExists(const QString& branch) const = 0;
+    // whether a commit of branch up to revnum was exported, so that a
+    // branch created from it starts out with its tree
+    virtual bool hasCommit(const QString &branch, int revnum) = 0;
     virtual const QByteArray branchNote(const QString& branch) const = 0;
     virtual void setBranchNote(const QString& branch, const QByteArray& noteText) = 0;
 
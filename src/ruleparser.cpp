@@ -23,6 +23,94 @@
 #include "ruleparser.h"
 #include "CommandLineParser.h"
 
+// false if PCRE2 could read pattern differently than QRegExp::RegExp2 or
+// pick another match
+static bool matchesLikeQRegExp(const QString &pattern)
+{
+    bool inSet = false;
+    for (int i = 0; i < pattern.size(); ++i) {
+        QChar c = pattern.at(i);
+        QChar next = i + 1 < pattern.size() ? pattern.at(i + 1) : QChar();
+        if (c == QLatin1Char('\\')) {
+            // \x, \0 and \u for example take other numbers of digits
+            if (next.isNull() || (next.isLetterOrNumber()
+                                  && !QStringLiteral("123456789bBdDsSwWnrtfv").contains(next)))
+                return false;
+            ++i;
+        } else if (inSet) {
+            // POSIX character classes are PCRE2 only
+            if (c == QLatin1Char('[') && next == QLatin1Char(':'))
+                return false;
+            inSet = c != QLatin1Char(']');
+        } else if (c == QLatin1Char('[')) {
+            // whether a ] first in a set closes it differs
+            int first = next == QLatin1Char('^') ? i + 2 : i + 1;
+            if (first < pattern.size() && pattern.at(first) == QLatin1Char(']'))
+                return false;
+            inSet = true;
+        } else if (c == QLatin1Char('|')) {
+            // QRegExp takes the longest alternative, PCRE2 the first
+            return false;
+        } else if (c == QLatin1Char('(') && next == QLatin1Char('?')) {
+            QChar kind = i + 2 < pattern.size() ? pattern.at(i + 2) : QChar();
+            if (kind != QLatin1Char(':') && kind != QLatin1Char('=') && kind != QLatin1Char('!'))
+                return false;
+            i += 2;
+        } else if (QStringLiteral("*+?}").contains(c)
+                   && (next == QLatin1Char('?') || next == QLatin1Char('+'))) {
+            // lazy and possessive quantifiers
+            return false;
+        }
+    }
+    return true;
+}
+
+RuleRegExp::RuleRegExp(const QString &pattern)
+    : rx(pattern, Qt::CaseSensitive, QRegExp::RegExp2), pcre(false)
+{
+    if (!rx.isValid() || CommandLineParser::instance()->contains("qregexp")
+            || !matchesLikeQRegExp(pattern))
+        return;
+
+    // QRegExp's . matches newlines and \w all letters
+    re = QRegularExpression(pattern, QRegularExpression::DotMatchesEverythingOption
+                            | QRegularExpression::UseUnicodePropertiesOption);
+    if (!re.isValid())
+        return;
+    re.optimize();
+    pcre = true;
+}
+
+int RuleRegExp::matchedLength(const QString &string) const
+{
+    if (pcre) {
+#if QT_VERSION >= 0x060000
+        QRegularExpressionMatch match = re.match(string, 0, QRegularExpression::NormalMatch,
+                                                 QRegularExpression::AnchorAtOffsetMatchOption);
+#else
+        QRegularExpressionMatch match = re.match(string, 0, QRegularExpression::NormalMatch,
+                                                 QRegularExpression::AnchoredMatchOption);
+#endif
+        return match.hasMatch() ? match.capturedLength() : -1;
+    }
+
+    // a copy keeps the match state, so that threads can share the rules
+    QRegExp copy = rx;
+    return copy.indexIn(string) == 0 ? copy.matchedLength() : -1;
+}
+
+QString RuleRegExp::replaceIn(const QString &string, const QString &after) const
+{
+    QString result = string;
+    if (pcre)
+        return result.replace(re, after);
+#if QT_VERSION >= 0x060000
+    return rx.replaceIn(result, after);
+#else
+    return result.replace(rx, after);
+#endif
+}
+
 RulesList::RulesList(const QString &filenames)
   : m_filenames(filenames)
 {
@@ -111,7 +199,7 @@ Rules::Match::Substitution Rules::parseSubstitution(const QString &string)
     }
 
     // Found the end of the pattern
-    subst.pattern = QRegExp(string.mid(2, end - 2));
+    subst.pattern = RuleRegExp(string.mid(2, end - 2));
     if (!subst.pattern.isValid())
         return Match::Substitution(); // error
     subst.replacement = string.mid(end + 1, string.length() - 1 - end - 1);
@@ -142,6 +230,7 @@ void Rules::load(const QString &filename)
     QRegExp matchRevLine("(min|max) revision (\\d+)", Qt::CaseInsensitive);
     QRegExp matchAnnotateLine("annotated\\s+(\\S+)", Qt::CaseInsensitive);
     QRegExp matchPrefixLine("prefix\\s+(.*)$", Qt::CaseInsensitive);
+    QRegExp matchLfsLine("lfs\\s+(\\S+)", Qt::CaseInsensitive);
     QRegExp declareLine("declare\\s+("+varRegex+")\\s*=\\s*(\\S+)", Qt::CaseInsensitive);
     QRegExp variableLine("\\$\\{("+varRegex+")(\\|[^}$]*)?\\}", Qt::CaseInsensitive);
     QRegExp includeLine("include\\s+(.*)", Qt::CaseInsensitive);
@@ -206,6 +295,9 @@ void Rules::load(const QString &filename)
                 } else if (matchPrefixLine.exactMatch(line)) {
                     repo.prefix = matchPrefixLine.cap(1);
                     continue;
+                } else if (matchLfsLine.exactMatch(line)) {
+                    repo.lfsPatterns += matchLfsLine.cap(1);
+                    continue;
                 } else if (line == "end repository") {
                     if (!repo.forwardTo.isEmpty()
                         && !repo.description.isEmpty()) {
@@ -219,6 +311,12 @@ void Rules::load(const QString &filename)
                         qFatal("Specifing repository and branches on repository is invalid on line %d", lineNumber);
                     }
 
+                    if (!repo.forwardTo.isEmpty()
+                        && !repo.lfsPatterns.isEmpty()) {
+
+                        qFatal("Specifing repository and lfs on repository is invalid on line %d", lineNumber);
+                    }
+
                     m_repositories += repo;
                     {
                         // clear out 'repo'
@@ -301,7 +399,7 @@ void Rules::load(const QString &filename)
                 // match rule
                 state = ReadingMatch;
                 match = Match();
-                match.rx = QRegExp(matchLine.cap(1), Qt::CaseSensitive, QRegExp::RegExp2);
+                match.rx = RuleRegExp(matchLine.cap(1));
                 if( !match.rx.isValid() )
                     qFatal("Malformed regular expression '%s' in file:'%s':%d, Error: %s",
                            qPrintable(matchLine.cap(1)), qPrintable(filename), lineNumber,
@@ -330,8 +428,14 @@ public:
     void printStats() const;
     void ruleMatched(const Rules::Match &rule, const int rev);
     void addRule(const Rules::Match &rule);
+    void cacheLookup(const QString &cache, bool hit);
+    void setting(const QString &name, const QString &value);
+    void count(const QString &counter, qint64 amount);
 private:
     QMap<Rules::Match,int> m_usedRules;
+    QMap<QString, QPair<qint64, qint64> > m_cacheLookups;  // hits, misses
+    QMap<QString, QString> m_settings;
+    QMap<QString, qint64> m_counters;
 };
 
 Stats::Stats() : d(new Private())
@@ -374,6 +478,30 @@ void Stats::addRule( const Rules::Match &rule)
         d->addRule(rule);
 }
 
+void Stats::cacheHit(const char *cache)
+{
+    if(use)
+        d->cacheLookup(QLatin1String(cache), true);
+}
+
+void Stats::cacheMiss(const char *cache)
+{
+    if(use)
+        d->cacheLookup(QLatin1String(cache), false);
+}
+
+void Stats::setting(const QString &name, const QString &value)
+{
+    if(use)
+        d->setting(name, value);
+}
+
+void Stats::count(const QString &counter, qint64 amount)
+{
+    if(use)
+        d->count(counter, amount);
+}
+
 Stats::Private::Private()
 {
 }
@@ -384,6 +512,31 @@ void Stats::Private::printStats() const
     foreach(const Rules::Match rule, m_usedRules.keys()) {
         printf("%s was matched %i times\n", qPrintable(rule.info()), m_usedRules[rule]);
     }
+
+    if (!m_cacheLookups.isEmpty()) {
+        printf("\nCache stats\n");
+        QMap<QString, QPair<qint64, qint64> >::ConstIterator it = m_cacheLookups.constBegin();
+        for ( ; it != m_cacheLookups.constEnd(); ++it) {
+            qint64 hits = it.value().first;
+            qint64 lookups = hits + it.value().second;
+            printf("%s cache: %lld hits, %lld misses (%.1f%% hit rate)\n", qPrintable(it.key()),
+                   hits, it.value().second, lookups ? 100.0 * hits / lookups : 0.0);
+        }
+    }
+
+    if (!m_counters.isEmpty()) {
+        printf("\nCounters\n");
+        QMap<QString, qint64>::ConstIterator it = m_counters.constBegin();
+        for ( ; it != m_counters.constEnd(); ++it)
+            printf("%s: %lld\n", qPrintable(it.key()), it.value());
+    }
+
+    if (!m_settings.isEmpty()) {
+        printf("\nSettings\n");
+        QMap<QString, QString>::ConstIterator it = m_settings.constBegin();
+        for ( ; it != m_settings.constEnd(); ++it)
+            printf("%s: %s\n", qPrintable(it.key()), qPrintable(it.value()));
+    }
 }
 
 void Stats::Private::ruleMatched(const Rules::Match &rule, const int rev)
@@ -397,6 +550,25 @@ void Stats::Private::ruleMatched(const Rules::Match &rule, const int rev)
     }
 }
 
+void Stats::Private::cacheLookup(const QString &cache, bool hit)
+{
+    QPair<qint64, qint64> &lookups = m_cacheLookups[cache];
+    if (hit)
+        lookups.first++;
+    else
+        lookups.second++;
+}
+
+void Stats::Private::setting(const QString &name, const QString &value)
+{
+    m_settings.insert(name, value);
+}
+
+void Stats::Private::count(const QString &counter, qint64 amount)
+{
+    m_counters[counter] += amount;
+}
+
 void Stats::Private::addRule( const Rules::Match &rule)
 {
     if(m_usedRules.contains(rule))
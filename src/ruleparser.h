@@ -21,10 +21,41 @@
 #include <QList>
 #include <QMap>
 #include <QRegExp>
+#include <QRegularExpression>
 #include <QString>
 #include <QStringList>
 #include <QStringBuilder>
 
+/*
+ * A regular expression of the rules files, written for the RegExp2 syntax
+ * of QRegExp. It runs on PCRE2 with JIT through QRegularExpression unless
+ * the pattern uses something PCRE2 reads or matches differently, like
+ * alternatives, of which QRegExp takes the longest match and PCRE2 the
+ * first, or --qregexp was given; then QRegExp runs it as before.
+ */
+class RuleRegExp
+{
+public:
+    RuleRegExp() : pcre(false) {}
+    explicit RuleRegExp(const QString &pattern);
+
+    bool isEmpty() const { return rx.isEmpty(); }
+    bool isValid() const { return rx.isValid(); }
+    QString pattern() const { return rx.pattern(); }
+    QString errorString() const { return rx.errorString(); }
+
+    // the length of the match at the start of string, -1 if there is none
+    int matchedLength(const QString &string) const;
+    // string with all matches replaced by after, which can refer to captures
+    // with \1 to \99
+    QString replaceIn(const QString &string, const QString &after) const;
+
+private:
+    QRegExp rx;
+    QRegularExpression re;
+    bool pcre;
+};
+
 class Rules
 {
 public:
@@ -47,6 +78,7 @@ public:
 
         QString forwardTo;
         QString prefix;
+        QStringList lfsPatterns;
 
         Repository() { }
         const QString info() const {
@@ -59,18 +91,14 @@ public:
     struct Match : Rule
     {
         struct Substitution {
-            QRegExp pattern;
+            RuleRegExp pattern;
             QString replacement;
 
             bool isValid() { return !pattern.isEmpty(); }
-#if QT_VERSION >= 0x060000
-            QString apply(QString &string) { return pattern.replaceIn(string, replacement); }
-#else
-            QString& apply(QString &string) { return string.replace(pattern, replacement); }
-#endif
+            QString& apply(QString &string) { return string = pattern.replaceIn(string, replacement); }
         };
 
-        QRegExp rx;
+        RuleRegExp rx;
         QString repository;
         QList<Substitution> repo_substs;
         QString branch;
@@ -139,6 +167,10 @@ public:
     void printStats() const;
     void ruleMatched(const Rules::Match &rule, const int rev = -1);
     void addRule( const Rules::Match &rule);
+    void cacheHit(const char *cache);
+    void cacheMiss(const char *cache);
+    void setting(const QString &name, const QString &value);
+    void count(const QString &counter, qint64 amount);
     static void init();
     ~Stats();
 
@@ -28,7 +28,12 @@
 #include "svn.h"
 #include "CommandLineParser.h"
 
+#include <algorithm>
+
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
@@ -38,25 +43,86 @@
 #include <apr_getopt.h>
 #include <apr_general.h>
 
+#include <svn_cache_config.h>
+#include <svn_checksum.h>
 #include <svn_fs.h>
 #include <svn_pools.h>
 #include <svn_repos.h>
 #include <svn_types.h>
 #include <svn_version.h>
 
+#include <QBitArray>
 #include <QFile>
+#include <QCache>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDebug>
+#include <QHash>
+#include <QMap>
+#include <QVector>
+#include <QMutex>
+#include <QSet>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QThread>
+#include <QVarLengthArray>
+#include <QWaitCondition>
+#include <QtEndian>
 
 #include "repository.h"
 
 #undef SVN_ERR
 #define SVN_ERR(expr) SVN_INT_ERR(expr)
 
+// for the helpers that hand the error on to their caller
+#define SVN_PROPAGATE_ERR(expr)                                 \
+    do {                                                        \
+        svn_error_t *svn_err__temp = (expr);                    \
+        if (svn_err__temp)                                      \
+            return svn_err__temp;                               \
+    } while (0)
+
 #if SVN_VER_MAJOR == 1 && SVN_VER_MINOR < 9
 #define svn_stream_read_full svn_stream_read
 #endif
 
-typedef QList<Rules::Match> MatchRuleList;
+/*
+ * The match rules of one rules file. Copies share an index of the literal
+ * prefixes the rules' regular expressions start with, kept in a trie, and
+ * of the rules active in each range of revisions in which none of them
+ * starts or ends, so that only the expressions of rules which can match a
+ * path in a revision have to run.
+ */
+class MatchRuleList : public QList<Rules::Match>
+{
+public:
+    MatchRuleList() {}
+    MatchRuleList(const QList<Rules::Match> &rules);
+
+    // the positions of the rules that can match path in revnum, in order
+    void candidates(QVarLengthArray<int, 64> *result, int revnum, const QString &path) const;
+    // whether none of the rules before position rule can match a path
+    // below the directory dir in revnum, as far as their prefixes tell
+    bool firstBelow(int rule, int revnum, const QString &dir) const;
+
+private:
+    struct Node
+    {
+        QHash<QChar, int> children;
+        QVector<int> rules;
+    };
+    struct Index
+    {
+        QVector<Node> trie;
+        QVector<int> epochStarts;
+        QVector<QBitArray> active;
+    };
+
+    QSharedPointer<const Index> index;
+
+    const QBitArray &activeRules(int revnum) const;
+};
+
 typedef QHash<QString, Repository *> RepositoryHash;
 typedef QHash<QByteArray, QByteArray> IdentityHash;
 
@@ -80,6 +146,50 @@ public:
     inline operator apr_pool_t *() const { return pool; }
 };
 
+// Plain copy of the parts of a changed-path record we use, together with
+// the results of the lookups exportEntry needs. It only holds Qt types so
+// that it can be prepared on a prefetch thread and outlive its pool.
+struct PathChange
+{
+    QByteArray path;
+    svn_fs_path_change_kind_t change_kind;
+    svn_boolean_t text_mod;
+    svn_boolean_t prop_mod;
+    QByteArray copyfrom_path;   // null if not copied
+    svn_revnum_t copyfrom_rev;
+    bool is_dir;                // in this revision
+    bool was_dir;               // in the previous revision, only set for deletions
+};
+// sorted by path
+typedef QVector<PathChange> PathChangeList;
+
+// Everything SvnRevision needs to know about a revision before it can start
+// exporting it.
+struct RevisionInfo
+{
+    int revnum;
+    PathChangeList changes;
+
+    // null if the revision property is not set
+    bool revpropsFetched;
+    QByteArray author;
+    QByteArray date;
+    QByteArray log;
+
+    RevisionInfo() : revnum(0), revpropsFetched(false) {}
+};
+
+class RevisionPrefetcher;
+class RevisionRootCache;
+class DirEntriesCache;
+class NodePropsCache;
+class BlobReader;
+class ReadaheadPlanner;
+class DumpLoader;
+class ChangesIndex;
+class TreeWalker;
+class DirOccupancy;
+
 class SvnPrivate
 {
 public:
@@ -91,15 +201,32 @@ public:
     SvnPrivate(const QString &pathToRepository);
     ~SvnPrivate();
     int youngestRevision();
+    bool waitForRevision(int revnum);
+    bool inputFailed();
     int exportRevision(int revnum);
 
     int openRepository(const QString &pathToRepository);
+    void startPrefetch(const QList<int> &revisions, int lookahead);
+    void updateChangesIndex();
+    bool touchesExportedPath(int revnum);
 
 private:
     AprAutoPool global_pool;
     AprAutoPool scratch_pool;
+    QString repositoryPath;
     svn_fs_t *fs;
     svn_revnum_t youngest_rev;
+    RevisionPrefetcher *prefetcher;
+    RevisionRootCache *rootCache;
+    DirEntriesCache *dirCache;
+    NodePropsCache *propCache;
+    BlobReader *blobReader;
+    ReadaheadPlanner *readahead;
+    DumpLoader *loader;
+    ChangesIndex *changesIndex;
+    TreeWalker *walker;
+    DirOccupancy *occupancy;
+    QHash<int, bool> exportedPathTouched;
 };
 
 void Svn::initialize()
@@ -124,9 +251,11 @@ Svn::~Svn()
     delete d;
 }
 
-void Svn::setMatchRules(const QList<MatchRuleList> &allMatchRules)
+void Svn::setMatchRules(const QList<QList<Rules::Match> > &allMatchRules)
 {
-    d->allMatchRules = allMatchRules;
+    d->allMatchRules.clear();
+    foreach (const QList<Rules::Match> &matchRules, allMatchRules)
+        d->allMatchRules << MatchRuleList(matchRules);
 }
 
 void Svn::setRepositories(const RepositoryHash &repositories)
@@ -149,81 +278,507 @@ int Svn::youngestRevision()
     return d->youngestRevision();
 }
 
-bool Svn::exportRevision(int revnum)
+void Svn::prefetchRevisions(const QList<int> &revisions)
 {
-    return d->exportRevision(revnum) == EXIT_SUCCESS;
+    int lookahead = CommandLineParser::instance()->optionArgument(QLatin1String("prefetch"), QLatin1String("0")).toInt();
+    if (lookahead > 0)
+        d->startPrefetch(revisions, lookahead);
 }
 
-SvnPrivate::SvnPrivate(const QString &pathToRepository)
-    : global_pool(NULL) , scratch_pool(NULL)
+bool Svn::waitForRevision(int revnum)
 {
-    if( openRepository(pathToRepository) != EXIT_SUCCESS) {
-        qCritical() << "Failed to open repository";
-        exit(1);
-    }
+    return d->waitForRevision(revnum);
+}
 
-    // get the youngest revision
-    svn_fs_youngest_rev(&youngest_rev, fs, global_pool);
+bool Svn::inputFailed()
+{
+    return d->inputFailed();
 }
 
-SvnPrivate::~SvnPrivate() {}
+bool Svn::exportRevision(int revnum)
+{
+    return d->exportRevision(revnum) == EXIT_SUCCESS;
+}
 
 int SvnPrivate::youngestRevision()
 {
     return youngest_rev;
 }
 
-int SvnPrivate::openRepository(const QString &pathToRepository)
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 7
+/*
+ * The FSFS caches to enable with --fs-cache. Their names are the ones
+ * used in the list passed to the option.
+ */
+static const struct {
+    const char *name;
+    const char *configKey;
+} fsCaches[] = {
+    { "deltas", SVN_FS_CONFIG_FSFS_CACHE_DELTAS },
+    { "fulltexts", SVN_FS_CONFIG_FSFS_CACHE_FULLTEXTS },
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 8
+    { "revprops", SVN_FS_CONFIG_FSFS_CACHE_REVPROPS },
+#endif
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 10
+    { "nodeprops", SVN_FS_CONFIG_FSFS_CACHE_NODEPROPS },
+#endif
+};
+
+static apr_hash_t *fsConfig(apr_pool_t *pool)
+{
+    if (!CommandLineParser::instance()->contains(QLatin1String("fs-cache")))
+        return NULL;
+
+    apr_hash_t *config = apr_hash_make(pool);
+    QStringList names = CommandLineParser::instance()->optionArgument(QLatin1String("fs-cache"))
+        .split(QLatin1Char(','), Qt::SkipEmptyParts);
+    foreach (const QString &name, names) {
+        bool known = false;
+        for (uint i = 0; i < sizeof(fsCaches) / sizeof(fsCaches[0]); ++i) {
+            if (name.trimmed() == QLatin1String(fsCaches[i].name)) {
+                apr_hash_set(config, fsCaches[i].configKey, APR_HASH_KEY_STRING, "1");
+                known = true;
+            }
+        }
+        if (!known)
+            qWarning() << "WARN: Unknown or unsupported --fs-cache type" << name << ", ignoring";
+    }
+    return config;
+}
+
+// must be called before the first repository is opened
+static void configureFsCache()
+{
+    svn_cache_config_t config = *svn_cache_config_get();
+    if (CommandLineParser::instance()->contains(QLatin1String("fs-cache-size"))) {
+        int size = CommandLineParser::instance()->optionArgument(QLatin1String("fs-cache-size")).toInt();
+        config.cache_size = apr_uint64_t(qMax(0, size)) * 1024 * 1024;
+    }
+    svn_cache_config_set(&config);
+
+    Stats::instance()->setting("FS membuffer cache",
+                               QString("%1 MB").arg(config.cache_size / (1024 * 1024)));
+    if (CommandLineParser::instance()->contains(QLatin1String("fs-cache")))
+        Stats::instance()->setting("FS caches enabled",
+                                   CommandLineParser::instance()->optionArgument(QLatin1String("fs-cache")));
+}
+#else
+static apr_hash_t *fsConfig(apr_pool_t *)
+{
+    return NULL;
+}
+
+static void configureFsCache()
+{
+}
+#endif
+
+static QString cleanRepositoryPath(const QString &pathToRepository)
 {
-    svn_repos_t *repos;
     QString path = pathToRepository;
     while (path.endsWith('/')) // no trailing slash allowed
         path = path.mid(0, path.length()-1);
+    return path;
+}
+
+static int openRepos(svn_repos_t **repos, const QString &pathToRepository, apr_pool_t *pool, apr_pool_t *scratch_pool)
+{
+    QString path = cleanRepositoryPath(pathToRepository);
 #if SVN_VER_MAJOR == 1 && SVN_VER_MINOR < 7
-    SVN_ERR(svn_repos_open(&repos, QFile::encodeName(path), global_pool));
+    Q_UNUSED(scratch_pool);
+    SVN_ERR(svn_repos_open(repos, QFile::encodeName(path), pool));
 #elif SVN_VER_MAJOR == 1 && SVN_VER_MINOR < 9
-    SVN_ERR(svn_repos_open2(&repos, QFile::encodeName(path), NULL, global_pool));
+    Q_UNUSED(scratch_pool);
+    SVN_ERR(svn_repos_open2(repos, QFile::encodeName(path), fsConfig(pool), pool));
+#else
+    SVN_ERR(svn_repos_open3(repos, QFile::encodeName(path), fsConfig(pool), pool, scratch_pool));
+#endif
+
+    return EXIT_SUCCESS;
+}
+
+static int openFs(svn_fs_t **fs, const QString &pathToRepository, apr_pool_t *pool, apr_pool_t *scratch_pool)
+{
+    svn_repos_t *repos;
+    if (openRepos(&repos, pathToRepository, pool, scratch_pool) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    *fs = svn_repos_fs(repos);
+
+    return EXIT_SUCCESS;
+}
+
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 8
+/*
+ * Loads an svnadmin dump into the repository we export from, so that the
+ * export of each revision can start as soon as it has been committed
+ * instead of after the whole dump has been loaded.
+ */
+class DumpLoader : public QThread
+{
+public:
+    DumpLoader(const QString &pathToRepository, const QString &dumpFile, int youngest);
+    ~DumpLoader();
+
+    // returns false if the dump ended before revnum was loaded
+    bool waitForRevision(int revnum);
+    bool failed();
+
+protected:
+    void run();
+
+private:
+    int load(apr_pool_t *pool);
+    static void notify(void *baton, const svn_repos_notify_t *notify, apr_pool_t *pool);
+    static svn_error_t *cancel(void *baton);
+
+    QString repositoryPath;
+    QString dumpFile;
+
+    QMutex mutex;
+    QWaitCondition revisionLoaded;
+    int loaded;
+    bool finished;
+    bool error;
+    bool stopping;
+};
+
+static int createRepository(const QString &pathToRepository, apr_pool_t *pool)
+{
+    QString path = cleanRepositoryPath(pathToRepository);
+    if (QFile::exists(path + "/format"))
+        return EXIT_SUCCESS;
+
+    svn_repos_t *repos;
+    SVN_ERR(svn_repos_create(&repos, QFile::encodeName(path), NULL, NULL, NULL, fsConfig(pool), pool));
+    return EXIT_SUCCESS;
+}
+
+DumpLoader::DumpLoader(const QString &pathToRepository, const QString &file, int youngest)
+    : repositoryPath(pathToRepository), dumpFile(file), loaded(youngest),
+      finished(false), error(false), stopping(false)
+{
+}
+
+DumpLoader::~DumpLoader()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+    }
+    wait();
+}
+
+bool DumpLoader::waitForRevision(int revnum)
+{
+    QMutexLocker locker(&mutex);
+    while (loaded < revnum && !finished)
+        revisionLoaded.wait(&mutex);
+    return loaded >= revnum;
+}
+
+bool DumpLoader::failed()
+{
+    QMutexLocker locker(&mutex);
+    return error;
+}
+
+void DumpLoader::notify(void *baton, const svn_repos_notify_t *notify, apr_pool_t *)
+{
+    if (notify->action != svn_repos_notify_load_txn_committed)
+        return;
+    DumpLoader *loader = reinterpret_cast<DumpLoader *>(baton);
+    QMutexLocker locker(&loader->mutex);
+    loader->loaded = notify->new_revision;
+    loader->revisionLoaded.wakeAll();
+}
+
+svn_error_t *DumpLoader::cancel(void *baton)
+{
+    DumpLoader *loader = reinterpret_cast<DumpLoader *>(baton);
+    QMutexLocker locker(&loader->mutex);
+    if (loader->stopping)
+        return svn_error_create(SVN_ERR_CANCELLED, NULL, "Export finished");
+    return SVN_NO_ERROR;
+}
+
+int DumpLoader::load(apr_pool_t *pool)
+{
+    svn_repos_t *repos;
+    if (openRepos(&repos, repositoryPath, pool, pool) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    svn_stream_t *stream;
+    if (dumpFile == QLatin1String("-")) {
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 10
+        SVN_ERR(svn_stream_for_stdin2(&stream, TRUE, pool));
+#else
+        SVN_ERR(svn_stream_for_stdin(&stream, pool));
+#endif
+    } else {
+        SVN_ERR(svn_stream_open_readonly(&stream, QFile::encodeName(dumpFile), pool, pool));
+    }
+
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 10
+    svn_error_t *err = svn_repos_load_fs6(repos, stream, SVN_INVALID_REVNUM, SVN_INVALID_REVNUM,
+                                          svn_repos_load_uuid_default, NULL, FALSE, FALSE, FALSE,
+                                          FALSE, FALSE, notify, this, cancel, this, pool);
+#elif SVN_VER_MINOR >= 9
+    svn_error_t *err = svn_repos_load_fs5(repos, stream, SVN_INVALID_REVNUM, SVN_INVALID_REVNUM,
+                                          svn_repos_load_uuid_default, NULL, FALSE, FALSE, FALSE,
+                                          FALSE, notify, this, cancel, this, pool);
 #else
-    SVN_ERR(svn_repos_open3(&repos, QFile::encodeName(path), NULL, global_pool, scratch_pool));
+    svn_error_t *err = svn_repos_load_fs4(repos, stream, SVN_INVALID_REVNUM, SVN_INVALID_REVNUM,
+                                          svn_repos_load_uuid_default, NULL, FALSE, FALSE, FALSE,
+                                          notify, this, cancel, this, pool);
 #endif
-    fs = svn_repos_fs(repos);
+    if (err) {
+        if (err->apr_err != SVN_ERR_CANCELLED)
+            svn_handle_error2(err, stderr, FALSE, "svn-all-fast-export: ");
+        svn_error_clear(err);
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
 
-enum RuleType { AnyRule = 0, NoIgnoreRule = 0x01, NoRecurseRule = 0x02 };
+void DumpLoader::run()
+{
+    AprAutoPool pool;
+    int result = load(pool);
+
+    QMutexLocker locker(&mutex);
+    if (result != EXIT_SUCCESS && !stopping) {
+        qCritical() << "Failed to load" << dumpFile << "after revision" << loaded;
+        error = true;
+    }
+    finished = true;
+    revisionLoaded.wakeAll();
+}
+#endif
+
+int SvnPrivate::openRepository(const QString &pathToRepository)
+{
+    repositoryPath = pathToRepository;
+    return openFs(&fs, pathToRepository, global_pool, scratch_pool);
+}
+
+// the characters every string matched by rx at its start begins with
+static QString literalPrefix(const RuleRegExp &rx)
+{
+    QString prefix;
+    const QString pattern = rx.pattern();
+    // any alternative could start with something else
+    if (pattern.contains(QLatin1Char('|')))
+        return prefix;
+
+    const QString special = QStringLiteral("^$.|?*+()[]{}");
+    const QString optional = QStringLiteral("?*{");
+    int i = pattern.startsWith(QLatin1Char('^')) ? 1 : 0;
+    while (i < pattern.size()) {
+        QChar c = pattern.at(i);
+        int next = i + 1;
+        if (c == QLatin1Char('\\')) {
+            // escapes like \d or \1 are no literal characters
+            if (next == pattern.size() || pattern.at(next).isLetterOrNumber())
+                break;
+            c = pattern.at(next++);
+        } else if (special.contains(c)) {
+            break;
+        }
+        if (next < pattern.size() && optional.contains(pattern.at(next)))
+            break;
+        prefix += c;
+        i = next;
+    }
+    return prefix;
+}
+
+MatchRuleList::MatchRuleList(const QList<Rules::Match> &rules)
+    : QList<Rules::Match>(rules)
+{
+    Index *built = new Index;
+    built->trie.resize(1);
+    QVector<int> epochStarts;
+    epochStarts << INT_MIN;
+    for (int i = 0; i < rules.size(); ++i) {
+        const Rules::Match &rule = rules.at(i);
+        int node = 0;
+        foreach (QChar c, literalPrefix(rule.rx)) {
+            int child = built->trie[node].children.value(c, -1);
+            if (child == -1) {
+                child = built->trie.size();
+                built->trie[node].children.insert(c, child);
+                built->trie.resize(child + 1);
+            }
+            node = child;
+        }
+        built->trie[node].rules << i;
+
+        epochStarts << rule.minRevision;
+        if (rule.maxRevision != -1)
+            epochStarts << rule.maxRevision + 1;
+    }
+
+    // no rule starts or ends within an epoch, so its first revision tells
+    // which rules are active in all of it
+    std::sort(epochStarts.begin(), epochStarts.end());
+    epochStarts.erase(std::unique(epochStarts.begin(), epochStarts.end()), epochStarts.end());
+    foreach (int start, epochStarts) {
+        QBitArray active(rules.size());
+        for (int i = 0; i < rules.size(); ++i) {
+            const Rules::Match &rule = rules.at(i);
+            active.setBit(i, rule.minRevision <= start
+                          && (rule.maxRevision == -1 || rule.maxRevision >= start));
+        }
+        built->active << active;
+    }
+    built->epochStarts = epochStarts;
+    index = QSharedPointer<const Index>(built);
+}
+
+const QBitArray &MatchRuleList::activeRules(int revnum) const
+{
+    return index->active.at(
+        std::upper_bound(index->epochStarts.constBegin(), index->epochStarts.constEnd(), revnum)
+        - index->epochStarts.constBegin() - 1);
+}
+
+void MatchRuleList::candidates(QVarLengthArray<int, 64> *result, int revnum, const QString &path) const
+{
+    if (!index) {
+        for (int i = 0; i < size(); ++i)
+            result->append(i);
+        return;
+    }
+
+    const QBitArray &active = activeRules(revnum);
+    int node = 0;
+    for (int i = 0; ; ++i) {
+        foreach (int rule, index->trie.at(node).rules) {
+            if (active.testBit(rule))
+                result->append(rule);
+        }
+        if (i == path.size())
+            break;
+        node = index->trie.at(node).children.value(path.at(i), -1);
+        if (node == -1)
+            break;
+    }
+    std::sort(result->begin(), result->end());
+}
+
+bool MatchRuleList::firstBelow(int rule, int revnum, const QString &dir) const
+{
+    if (!index)
+        return rule == 0;
+
+    const QBitArray &active = activeRules(revnum);
+    // the rules whose prefixes dir starts with
+    int node = 0;
+    for (int i = 0; ; ++i) {
+        foreach (int other, index->trie.at(node).rules) {
+            if (other < rule && active.testBit(other))
+                return false;
+        }
+        if (i == dir.size())
+            break;
+        node = index->trie.at(node).children.value(dir.at(i), -1);
+        if (node == -1)
+            return true;
+    }
+
+    // and those whose prefixes go on below dir
+    QVector<int> pending;
+    foreach (int child, index->trie.at(node).children)
+        pending << child;
+    while (!pending.isEmpty()) {
+        node = pending.takeLast();
+        foreach (int other, index->trie.at(node).rules) {
+            if (other < rule && active.testBit(other))
+                return false;
+        }
+        foreach (int child, index->trie.at(node).children)
+            pending << child;
+    }
+    return true;
+}
+
+enum RuleType { AnyRule = 0, NoIgnoreRule = 0x01, NoRecurseRule = 0x02, NoStats = 0x04 };
 
 static MatchRuleList::ConstIterator
 findMatchRule(const MatchRuleList &matchRules, int revnum, const QString &current,
               int ruleMask = AnyRule)
 {
-    MatchRuleList::ConstIterator it = matchRules.constBegin(),
-                                end = matchRules.constEnd();
-    for ( ; it != end; ++it) {
-        if (it->minRevision > revnum)
-            continue;
-        if (it->maxRevision != -1 && it->maxRevision < revnum)
-            continue;
+    QVarLengthArray<int, 64> candidates;
+    matchRules.candidates(&candidates, revnum, current);
+    for (int i = 0; i < candidates.size(); ++i) {
+        MatchRuleList::ConstIterator it = matchRules.constBegin() + candidates.at(i);
         if (it->action == Rules::Match::Ignore && ruleMask & NoIgnoreRule)
             continue;
         if (it->action == Rules::Match::Recurse && ruleMask & NoRecurseRule)
             continue;
-        if (it->rx.indexIn(current) == 0) {
-            Stats::instance()->ruleMatched(*it, revnum);
+        if (it->rx.matchedLength(current) != -1) {
+            if (!(ruleMask & NoStats))
+                Stats::instance()->ruleMatched(*it, revnum);
             return it;
         }
     }
 
     // no match
-    return end;
+    return matchRules.constEnd();
+}
+
+// whether the rule matching the directory dir in revnum decides all paths
+// below it as well, so that they go where dir goes
+static bool ruleDecidesBelow(const MatchRuleList &matchRules, int revnum, const QString &dir)
+{
+    MatchRuleList::ConstIterator match = findMatchRule(matchRules, revnum, dir, NoStats);
+    return match != matchRules.constEnd()
+        && matchRules.firstBelow(match - matchRules.constBegin(), revnum, dir);
+}
+
+typedef QMap<QByteArray, QByteArray> NodeProps;
+
+/*
+ * Properties of node revisions, keyed by node-revision ID. The whole
+ * proplist is read once and serves the mode, symlink, svn:ignore and
+ * unknown-property checks. Nodes that are reached again through a copy
+ * keep their ID and are served from the cache as well.
+ */
+class NodePropsCache
+{
+public:
+    NodePropsCache(TreeWalker *w) : walker(w), cache(maxCost) {}
+
+    svn_error_t *props(NodeProps *props, svn_fs_root_t *root, const char *path, apr_pool_t *scratch_pool);
+
+private:
+    static const int maxCost = 32 * 1024 * 1024;
+    TreeWalker *walker;
+    QCache<QByteArray, NodeProps> cache;
+};
+
+static svn_error_t *readNodeProps(NodeProps *props, svn_fs_root_t *root, const char *path,
+                                 apr_pool_t *scratch_pool)
+{
+    apr_hash_t *table;
+    SVN_PROPAGATE_ERR(svn_fs_node_proplist(&table, root, path, scratch_pool));
+
+    props->clear();
+    for (apr_hash_index_t *hi = apr_hash_first(scratch_pool, table); hi; hi = apr_hash_next(hi)) {
+        const void *propKey;
+        void *propVal;
+        apr_hash_this(hi, &propKey, NULL, &propVal);
+        const svn_string_t *value = reinterpret_cast<const svn_string_t *>(propVal);
+        props->insert(QByteArray(reinterpret_cast<const char *>(propKey)), QByteArray(value->data, value->len));
+    }
+    return SVN_NO_ERROR;
 }
 
-static int pathMode(svn_fs_root_t *fs_root, const char *pathname, apr_pool_t *pool)
+static int pathMode(const NodeProps &props)
 {
-    svn_string_t *propvalue;
-    SVN_ERR(svn_fs_node_prop(&propvalue, fs_root, pathname, "svn:executable", pool));
     int mode = 0100644;
-    if (propvalue)
+    if (props.contains("svn:executable"))
         mode = 0100755;
 
     return mode;
@@ -252,64 +807,559 @@ static svn_stream_t *streamForDevice(QIODevice *device, apr_pool_t *pool)
     return stream;
 }
 
-static int dumpBlob(Repository::Transaction *txn, svn_fs_root_t *fs_root,
-                    const char *pathname, const QString &finalPathName, apr_pool_t *pool)
+// how --svn-eol-style and --svn-keywords change the contents of a file with
+// these properties, empty if the contents go to git as they are in svn
+static QByteArray contentTransform(const NodeProps &props)
 {
-    AprAutoPool dumppool(pool);
-    // what type is it?
-    int mode = pathMode(fs_root, pathname, dumppool);
+    QByteArray transform;
+    if (props.contains("svn:special"))
+        return transform;
+    if (CommandLineParser::instance()->contains("svn-eol-style") && props.contains("svn:eol-style"))
+        transform += "eol-style\n";
+    if (CommandLineParser::instance()->contains("svn-keywords") && props.contains("svn:keywords"))
+        transform += "keywords " + props.value("svn:keywords").simplified() + '\n';
+    return transform;
+}
 
-    svn_filesize_t stream_length;
+// CRLF and lone CR line endings become LF, memchr does the scanning
+static void normalizeEol(QByteArray *contents)
+{
+    const char *begin = contents->constData();
+    const char *end = begin + contents->size();
+    const char *cr = static_cast<const char *>(memchr(begin, '\r', end - begin));
+    if (!cr)
+        return;
+
+    QByteArray result;
+    result.reserve(contents->size());
+    const char *p = begin;
+    while (cr) {
+        result.append(p, cr - p);
+        result.append('\n');
+        p = cr + 1;
+        if (p < end && *p == '\n')
+            ++p;
+        cr = static_cast<const char *>(memchr(p, '\r', end - p));
+    }
+    result.append(p, end - p);
+    *contents = result;
+}
 
-    SVN_ERR(svn_fs_file_length(&stream_length, fs_root, pathname, dumppool));
+// the keyword names enabled by an svn:keywords value, with their aliases
+static QSet<QByteArray> keywordNames(const QByteArray &value)
+{
+    static const char *const aliases[][3] = {
+        {"LastChangedRevision", "Rev", "Revision"},
+        {"LastChangedDate", "Date", NULL},
+        {"LastChangedBy", "Author", NULL},
+        {"HeadURL", "URL", NULL},
+        {"Id", NULL, NULL},
+        {"Header", NULL, NULL},
+    };
+
+    QSet<QByteArray> names;
+    foreach (const QByteArray &word, value.simplified().split(' ')) {
+        int equals = word.indexOf('=');
+        if (equals > 0) {
+            // a custom keyword, NAME=FORMAT
+            names.insert(word.left(equals));
+            continue;
+        }
+        for (size_t i = 0; i < sizeof(aliases) / sizeof(aliases[0]); ++i) {
+            bool found = false;
+            for (int j = 0; j < 3 && aliases[i][j]; ++j)
+                found = found || qstricmp(word.constData(), aliases[i][j]) == 0;
+            for (int j = 0; found && j < 3 && aliases[i][j]; ++j)
+                names.insert(aliases[i][j]);
+        }
+    }
+    return names;
+}
 
-    svn_stream_t *in_stream, *out_stream;
-    if (!CommandLineParser::instance()->contains("dry-run")) {
-        // open the file
-        SVN_ERR(svn_fs_file_contents(&in_stream, fs_root, pathname, dumppool));
+// the longest keyword svn expands, SVN_KEYWORD_MAX_LEN
+static const int maxKeywordLength = 255;
+
+// the $ opening the next expanded keyword of names at or after from, NULL
+// if there is none; colon and close get the colon after its name and its
+// closing $
+static const char *nextExpandedKeyword(const char *from, const char *end, const QSet<QByteArray> &names,
+                                       const char **colon_p, const char **close_p)
+{
+    const char *dollar = from;
+    while ((dollar = static_cast<const char *>(memchr(dollar, '$', end - dollar)))) {
+        const char *name = dollar + 1;
+        const char *limit = end - dollar > maxKeywordLength ? dollar + maxKeywordLength : end;
+        const char *colon = name;
+        while (colon < limit && *colon != ':' && *colon != '$' && *colon != ' ' && *colon != '\n')
+            ++colon;
+        const char *close = colon < limit && *colon == ':'
+            ? static_cast<const char *>(memchr(colon, '$', limit - colon)) : NULL;
+        if (!close || memchr(colon, '\n', close - colon)
+                || !names.contains(QByteArray::fromRawData(name, colon - name))) {
+            dollar = name;
+            continue;
+        }
+        *colon_p = colon;
+        *close_p = close;
+        return dollar;
     }
+    return NULL;
+}
 
-    // maybe it's a symlink?
-    svn_string_t *propvalue;
-    SVN_ERR(svn_fs_node_prop(&propvalue, fs_root, pathname, "svn:special", dumppool));
-    if (propvalue) {
-        apr_size_t len = strlen("link ");
-        if (!CommandLineParser::instance()->contains("dry-run")) {
-            QByteArray buf;
-            buf.reserve(len);
-            SVN_ERR(svn_stream_read_full(in_stream, buf.data(), &len));
-            if (len == strlen("link ") && strncmp(buf, "link ", len) == 0) {
-                mode = 0120000;
-                stream_length -= len;
-            } else {
-                //this can happen if a link changed into a file in one commit
-                qWarning("file %s is svn:special but not a symlink", pathname);
-                // re-open the file as we tried to read "link "
-                svn_stream_close(in_stream);
-                SVN_ERR(svn_fs_file_contents(&in_stream, fs_root, pathname, dumppool));
-            }
+// expanded keywords like "$Id: file 12 $" go back to "$Id$", fixed width
+// ones like "$Id:: file 12 $" keep their width, as svn stores them
+static void unexpandKeywords(QByteArray *contents, const QByteArray &value)
+{
+    QSet<QByteArray> names = keywordNames(value);
+    if (names.isEmpty())
+        return;
+
+    const char *begin = contents->constData();
+    const char *end = begin + contents->size();
+    const char *p = begin;
+    const char *dollar = begin;
+    const char *colon, *close;
+    QByteArray result;
+    while ((dollar = nextExpandedKeyword(dollar, end, names, &colon, &close))) {
+        result.append(p, colon - p);
+        if (colon + 1 < close && colon[1] == ':') {
+            result.append("::");
+            result.append(QByteArray(close - colon - 2, ' '));
         }
+        result.append('$');
+        p = dollar = close + 1;
     }
+    if (p == begin)
+        return;
+    result.append(p, end - p);
+    *contents = result;
+}
 
-    QIODevice *io = txn->addFile(finalPathName, mode, stream_length);
+static void transformContents(QByteArray *contents, const NodeProps &props)
+{
+    if (CommandLineParser::instance()->contains("svn-eol-style") && props.contains("svn:eol-style"))
+        normalizeEol(contents);
+    if (CommandLineParser::instance()->contains("svn-keywords") && props.contains("svn:keywords"))
+        unexpandKeywords(contents, props.value("svn:keywords"));
+}
 
-    if (!CommandLineParser::instance()->contains("dry-run")) {
-        // open a generic svn_stream_t for the QIODevice
-        out_stream = streamForDevice(io, dumppool);
-        SVN_ERR(svn_stream_copy3(in_stream, out_stream, NULL, NULL, dumppool));
+// files up to this size are read into memory for translating right away,
+// larger ones only if needsTranslation finds something to translate
+static const svn_filesize_t maxUnscannedLength = 1024 * 1024;
+// larger files are exported untranslated
+static const svn_filesize_t maxTranslatedLength = 64 * 1024 * 1024;
 
-        // print an ending newline
-        io->putChar('\n');
+// whether transformContents would change the file, it is read in chunks
+static int needsTranslation(bool *result, svn_fs_root_t *fs_root, const char *pathname,
+                            const NodeProps &props, apr_pool_t *pool)
+{
+    bool eol = CommandLineParser::instance()->contains("svn-eol-style") && props.contains("svn:eol-style");
+    QSet<QByteArray> names;
+    if (CommandLineParser::instance()->contains("svn-keywords") && props.contains("svn:keywords"))
+        names = keywordNames(props.value("svn:keywords"));
+
+    svn_stream_t *in_stream;
+    SVN_ERR(svn_fs_file_contents(&in_stream, fs_root, pathname, pool));
+    const int chunkSize = 256 * 1024;
+    QByteArray buffer;
+    *result = false;
+    while (!*result) {
+        int kept = buffer.size();
+        buffer.resize(kept + chunkSize);
+        apr_size_t len = chunkSize;
+        SVN_ERR(svn_stream_read_full(in_stream, buffer.data() + kept, &len));
+        buffer.resize(kept + int(len));
+
+        const char *colon, *close;
+        const char *begin = buffer.constData();
+        *result = (eol && memchr(begin + kept, '\r', len))
+            || (!names.isEmpty() && nextExpandedKeyword(begin, begin + buffer.size(), names, &colon, &close));
+        if (int(len) < chunkSize)
+            break;
+        // a keyword can go on in the next chunk
+        buffer = buffer.right(maxKeywordLength);
     }
-
+    SVN_ERR(svn_stream_close(in_stream));
     return EXIT_SUCCESS;
 }
 
-static bool wasDir(svn_fs_t *fs, int revnum, const char *pathname, apr_pool_t *pool)
+/*
+ * Reads file contents ahead of the fast-import writer on worker threads,
+ * each with its own svn_fs_t. The writer still emits the files in its own
+ * order; it takes the finished buffers as it gets to them and reads the
+ * file itself if a request was not picked up yet, was too large or did
+ * not fit into the buffer budget.
+ */
+class BlobReader
 {
-    AprAutoPool subpool(pool);
-    svn_fs_root_t *fs_root;
-    if (svn_fs_revision_root(&fs_root, fs, revnum, subpool) != SVN_NO_ERROR)
+public:
+    BlobReader(const QString &pathToRepository, int threadCount);
+    ~BlobReader();
+
+    void request(int revnum, const QByteArray &path);
+
+    // returns false if the contents have not been read ahead, the caller
+    // must then read the file itself
+    bool take(int revnum, const QByteArray &path, QByteArray *contents);
+
+    // releases the contents of a request the caller does not need any
+    // more, without waiting for them
+    void drop(int revnum, const QByteArray &path);
+
+    // drops all requests and buffers that were not taken
+    void discard();
+
+private:
+    typedef QPair<int, QByteArray> Key;
+
+    class Worker : public QThread
+    {
+        BlobReader *reader;
+    public:
+        Worker(BlobReader *r) : reader(r) {}
+    protected:
+        void run();
+    };
+
+    bool claim(Key *key, int *generation);
+    void finish(const Key &key, int generation, bool ok, const QByteArray &contents);
+
+    static const svn_filesize_t maxBlobSize = 4 * 1024 * 1024;
+    static const qint64 maxBufferedBytes = 64 * 1024 * 1024;
+
+    QString repositoryPath;
+
+    QMutex mutex;
+    QWaitCondition workAvailable;
+    QWaitCondition resultAvailable;
+    QList<Key> queue;
+    QSet<Key> queued;
+    QSet<Key> reading;
+    QSet<Key> dropped;
+    QHash<Key, QByteArray> done;
+    qint64 bufferedBytes;
+    int generation;
+    bool stopping;
+    QList<Worker *> workers;
+};
+
+BlobReader::BlobReader(const QString &pathToRepository, int threadCount)
+    : repositoryPath(pathToRepository), bufferedBytes(0), generation(0), stopping(false)
+{
+    for (int i = 0; i < threadCount; ++i) {
+        Worker *worker = new Worker(this);
+        workers.append(worker);
+        worker->start();
+    }
+}
+
+BlobReader::~BlobReader()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        workAvailable.wakeAll();
+    }
+    foreach (Worker *worker, workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+void BlobReader::request(int revnum, const QByteArray &path)
+{
+    Key key(revnum, path);
+    QMutexLocker locker(&mutex);
+    if (queued.contains(key) || reading.contains(key) || done.contains(key))
+        return;
+    queue.append(key);
+    queued.insert(key);
+    workAvailable.wakeOne();
+}
+
+bool BlobReader::take(int revnum, const QByteArray &path, QByteArray *contents)
+{
+    Key key(revnum, path);
+    QMutexLocker locker(&mutex);
+    if (queued.remove(key)) {
+        // not started yet, reading it right away is faster than waiting
+        queue.removeOne(key);
+        return false;
+    }
+
+    while (reading.contains(key))
+        resultAvailable.wait(&mutex);
+
+    QHash<Key, QByteArray>::Iterator it = done.find(key);
+    if (it == done.end())
+        return false;
+    *contents = it.value();
+    bufferedBytes -= contents->size();
+    done.erase(it);
+    workAvailable.wakeAll();
+    return true;
+}
+
+void BlobReader::drop(int revnum, const QByteArray &path)
+{
+    Key key(revnum, path);
+    QMutexLocker locker(&mutex);
+    if (queued.remove(key)) {
+        queue.removeOne(key);
+        return;
+    }
+    if (reading.contains(key)) {
+        // finish() does not keep it
+        dropped.insert(key);
+        return;
+    }
+
+    QHash<Key, QByteArray>::Iterator it = done.find(key);
+    if (it == done.end())
+        return;
+    bufferedBytes -= it.value().size();
+    done.erase(it);
+    workAvailable.wakeAll();
+}
+
+void BlobReader::discard()
+{
+    QMutexLocker locker(&mutex);
+    ++generation;
+    queue.clear();
+    queued.clear();
+    reading.clear();
+    dropped.clear();
+    done.clear();
+    bufferedBytes = 0;
+    workAvailable.wakeAll();
+}
+
+bool BlobReader::claim(Key *key, int *claimedGeneration)
+{
+    QMutexLocker locker(&mutex);
+    // wait for the writer to take some of the buffers before reading more
+    while (!stopping && (queue.isEmpty() || bufferedBytes >= maxBufferedBytes))
+        workAvailable.wait(&mutex);
+    if (stopping)
+        return false;
+    *key = queue.takeFirst();
+    queued.remove(*key);
+    reading.insert(*key);
+    *claimedGeneration = generation;
+    return true;
+}
+
+void BlobReader::finish(const Key &key, int claimedGeneration, bool ok, const QByteArray &contents)
+{
+    QMutexLocker locker(&mutex);
+    if (claimedGeneration != generation)
+        return;
+    reading.remove(key);
+    bool wanted = !dropped.remove(key);
+    if (ok && wanted) {
+        done.insert(key, contents);
+        bufferedBytes += contents.size();
+    }
+    resultAvailable.wakeAll();
+}
+
+static int readBlob(QByteArray *contents, svn_fs_root_t *fs_root, const char *pathname,
+                    svn_filesize_t maxSize, apr_pool_t *pool)
+{
+    svn_filesize_t length;
+    SVN_ERR(svn_fs_file_length(&length, fs_root, pathname, pool));
+    if (length > maxSize)
+        return EXIT_FAILURE;
+
+    svn_stream_t *in_stream;
+    SVN_ERR(svn_fs_file_contents(&in_stream, fs_root, pathname, pool));
+    contents->resize(length);
+    apr_size_t len = length;
+    SVN_ERR(svn_stream_read_full(in_stream, contents->data(), &len));
+    if (svn_filesize_t(len) != length)
+        return EXIT_FAILURE;
+    SVN_ERR(svn_stream_close(in_stream));
+    return EXIT_SUCCESS;
+}
+
+void BlobReader::Worker::run()
+{
+    AprAutoPool pool;
+    svn_fs_t *fs = NULL;
+    if (openFs(&fs, reader->repositoryPath, pool, pool) != EXIT_SUCCESS)
+        fs = NULL;
+
+    // keep the root of the revision being read open between requests
+    AprAutoPool rootpool(pool.data());
+    svn_fs_root_t *fs_root = NULL;
+    int root_revnum = -1;
+
+    AprAutoPool filepool(pool.data());
+    Key key;
+    int generation;
+    while (reader->claim(&key, &generation)) {
+        filepool.clear();
+        QByteArray contents;
+        bool ok = false;
+        if (fs) {
+            if (key.first != root_revnum) {
+                rootpool.clear();
+                fs_root = NULL;
+                svn_error_t *err = svn_fs_revision_root(&fs_root, fs, key.first, rootpool);
+                if (err) {
+                    svn_error_clear(err);
+                    fs_root = NULL;
+                }
+                root_revnum = key.first;
+            }
+            ok = fs_root && readBlob(&contents, fs_root, key.second.constData(),
+                                     maxBlobSize, filepool) == EXIT_SUCCESS;
+        }
+        // on failure the main thread reads the file itself and reports errors
+        reader->finish(key, generation, ok, contents);
+    }
+}
+
+// with a contentKey, the SHA-1 of the file contents, the blob can be reused
+// by later files with the same contents
+static QIODevice *addBlob(Repository::Transaction *txn, const QString &finalPathName, int mode, qint64 length,
+                          const QByteArray &contentKey)
+{
+    // the contents of a symlink lose their "link " prefix
+    if (contentKey.isEmpty() || mode == 0120000)
+        return txn->addFile(finalPathName, mode, length);
+    return txn->addFile(finalPathName, mode, length, contentKey);
+}
+
+static int dumpBlob(Repository::Transaction *txn, svn_fs_root_t *fs_root, NodePropsCache *propCache,
+                    BlobReader *blobReader, const char *pathname, const QString &finalPathName,
+                    apr_pool_t *pool)
+{
+    AprAutoPool dumppool(pool);
+    // what type is it?
+    NodeProps props;
+    SVN_ERR(propCache->props(&props, fs_root, pathname, dumppool));
+    int mode = pathMode(props);
+    QByteArray transform = contentTransform(props);
+
+    // contents sent before in this fast-import session are only referenced
+    QByteArray contentKey;
+    if (!props.contains("svn:special")) {
+        svn_checksum_t *checksum;
+        SVN_ERR(svn_fs_file_checksum(&checksum, svn_checksum_sha1, fs_root, pathname, FALSE, dumppool));
+        if (checksum)
+            contentKey = QByteArray(reinterpret_cast<const char *>(checksum->digest), svn_checksum_size(checksum));
+        // translated contents are keyed by the svn contents and the translation
+        if (!contentKey.isEmpty() && !transform.isEmpty())
+            contentKey = QCryptographicHash::hash(contentKey + transform, QCryptographicHash::Sha1);
+    }
+    if (!contentKey.isEmpty() && txn->reuseFile(finalPathName, mode, contentKey)) {
+        // the contents read ahead would hold up the reads of other files
+        if (blobReader)
+            blobReader->drop(svn_fs_revision_root_revision(fs_root), pathname);
+        svn_filesize_t length;
+        SVN_ERR(svn_fs_file_length(&length, fs_root, pathname, dumppool));
+        Stats::instance()->cacheHit("blob content");
+        Stats::instance()->count("Blob bytes not sent again", length);
+        return EXIT_SUCCESS;
+    }
+    if (!contentKey.isEmpty())
+        Stats::instance()->cacheMiss("blob content");
+
+    QByteArray contents;
+    bool buffered = blobReader && blobReader->take(svn_fs_revision_root_revision(fs_root), pathname, &contents);
+    if (!buffered && !transform.isEmpty() && !CommandLineParser::instance()->contains("dry-run")) {
+        // translating changes the length fast-import gets before the
+        // contents, so only these files are read into memory first, and
+        // the large ones only if there is something to translate
+        svn_filesize_t length;
+        SVN_ERR(svn_fs_file_length(&length, fs_root, pathname, dumppool));
+        bool translate = true;
+        if (length > maxUnscannedLength
+                && needsTranslation(&translate, fs_root, pathname, props, dumppool) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        if (translate && length > maxTranslatedLength) {
+            qWarning("WARN: %s is too large to translate, exporting it as it is in svn", pathname);
+            translate = false;
+        }
+        if (translate) {
+            if (readBlob(&contents, fs_root, pathname, length, dumppool) != EXIT_SUCCESS) {
+                qWarning("WARN: failed to read %s", pathname);
+                return EXIT_FAILURE;
+            }
+            buffered = true;
+        }
+    }
+    if (buffered) {
+        if (!transform.isEmpty())
+            transformContents(&contents, props);
+        if (props.contains("svn:special")) {
+            if (contents.startsWith("link ")) {
+                mode = 0120000;
+                contents.remove(0, strlen("link "));
+            } else {
+                //this can happen if a link changed into a file in one commit
+                qWarning("file %s is svn:special but not a symlink", pathname);
+            }
+        }
+
+        QIODevice *io = addBlob(txn, finalPathName, mode, contents.size(), contentKey);
+        apr_size_t len = contents.size();
+        SVN_ERR(QIODevice_write(io, contents.constData(), &len));
+        io->putChar('\n');
+        return EXIT_SUCCESS;
+    }
+
+    svn_filesize_t stream_length;
+
+    SVN_ERR(svn_fs_file_length(&stream_length, fs_root, pathname, dumppool));
+
+    svn_stream_t *in_stream, *out_stream;
+    if (!CommandLineParser::instance()->contains("dry-run")) {
+        // open the file
+        SVN_ERR(svn_fs_file_contents(&in_stream, fs_root, pathname, dumppool));
+    }
+
+    // maybe it's a symlink?
+    if (props.contains("svn:special")) {
+        apr_size_t len = strlen("link ");
+        if (!CommandLineParser::instance()->contains("dry-run")) {
+            QByteArray buf;
+            buf.reserve(len);
+            SVN_ERR(svn_stream_read_full(in_stream, buf.data(), &len));
+            if (len == strlen("link ") && strncmp(buf, "link ", len) == 0) {
+                mode = 0120000;
+                stream_length -= len;
+            } else {
+                //this can happen if a link changed into a file in one commit
+                qWarning("file %s is svn:special but not a symlink", pathname);
+                // re-open the file as we tried to read "link "
+                svn_stream_close(in_stream);
+                SVN_ERR(svn_fs_file_contents(&in_stream, fs_root, pathname, dumppool));
+            }
+        }
+    }
+
+    QIODevice *io = addBlob(txn, finalPathName, mode, stream_length, contentKey);
+
+    if (!CommandLineParser::instance()->contains("dry-run")) {
+        // open a generic svn_stream_t for the QIODevice
+        out_stream = streamForDevice(io, dumppool);
+        SVN_ERR(svn_stream_copy3(in_stream, out_stream, NULL, NULL, dumppool));
+
+        // print an ending newline
+        io->putChar('\n');
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static bool wasDir(svn_fs_t *fs, int revnum, const char *pathname, apr_pool_t *pool)
+{
+    AprAutoPool subpool(pool);
+    svn_fs_root_t *fs_root;
+    if (svn_fs_revision_root(&fs_root, fs, revnum, subpool) != SVN_NO_ERROR)
         return false;
 
     svn_boolean_t is_dir;
@@ -319,13 +1369,1685 @@ static bool wasDir(svn_fs_t *fs, int revnum, const char *pathname, apr_pool_t *p
     return is_dir;
 }
 
-time_t get_epoch(const char* svn_date)
+/*
+ * Keeps the most recently used revision roots open, together with the node
+ * kinds already looked up in them, so that looking at the previous revision
+ * or at a copy source does not reopen a root for every path.
+ *
+ * Roots are only released in releaseUnused(), which is called between
+ * revisions, so a root handed out stays valid for the whole revision.
+ */
+class RevisionRootCache
+{
+public:
+    RevisionRootCache(svn_fs_t *f, apr_pool_t *parent) : fs(f), pool(parent) {}
+    ~RevisionRootCache();
+
+    svn_error_t *revisionRoot(svn_fs_root_t **root, int revnum);
+    svn_error_t *checkPath(svn_node_kind_t *kind, int revnum, const char *path, apr_pool_t *scratch_pool);
+    bool isDir(int revnum, const char *path, apr_pool_t *scratch_pool);
+
+    void releaseUnused();
+
+private:
+    struct Root
+    {
+        int revnum;
+        apr_pool_t *pool;
+        svn_fs_root_t *root;
+    };
+
+    svn_fs_t *fs;
+    AprAutoPool pool;
+    QList<Root> roots;  // least recently used first
+    QHash<int, QHash<QByteArray, svn_node_kind_t> > nodeKinds;
+};
+
+static const int maxCachedRevisionRoots = 16;
+
+RevisionRootCache::~RevisionRootCache()
+{
+    foreach (const Root &root, roots)
+        svn_pool_destroy(root.pool);
+}
+
+svn_error_t *RevisionRootCache::revisionRoot(svn_fs_root_t **root, int revnum)
+{
+    for (int i = roots.size() - 1; i >= 0; --i) {
+        if (roots.at(i).revnum == revnum) {
+            Stats::instance()->cacheHit("revision root");
+            roots.move(i, roots.size() - 1);
+            *root = roots.last().root;
+            return SVN_NO_ERROR;
+        }
+    }
+
+    Stats::instance()->cacheMiss("revision root");
+    Root entry;
+    entry.revnum = revnum;
+    entry.pool = svn_pool_create(pool);
+    svn_error_t *err = svn_fs_revision_root(&entry.root, fs, revnum, entry.pool);
+    if (err) {
+        svn_pool_destroy(entry.pool);
+        return err;
+    }
+    roots.append(entry);
+    *root = entry.root;
+    return SVN_NO_ERROR;
+}
+
+svn_error_t *RevisionRootCache::checkPath(svn_node_kind_t *kind, int revnum, const char *path,
+                                          apr_pool_t *scratch_pool)
+{
+    QHash<QByteArray, svn_node_kind_t> &kinds = nodeKinds[revnum];
+    QHash<QByteArray, svn_node_kind_t>::ConstIterator it = kinds.constFind(path);
+    if (it != kinds.constEnd()) {
+        Stats::instance()->cacheHit("node kind");
+        *kind = it.value();
+        return SVN_NO_ERROR;
+    }
+
+    Stats::instance()->cacheMiss("node kind");
+    svn_fs_root_t *root;
+    svn_error_t *err = revisionRoot(&root, revnum);
+    if (!err)
+        err = svn_fs_check_path(kind, root, path, scratch_pool);
+    if (err)
+        return err;
+    kinds.insert(path, *kind);
+    return SVN_NO_ERROR;
+}
+
+bool RevisionRootCache::isDir(int revnum, const char *path, apr_pool_t *scratch_pool)
+{
+    svn_node_kind_t kind;
+    svn_error_t *err = checkPath(&kind, revnum, path, scratch_pool);
+    if (err) {
+        svn_error_clear(err);
+        return false;
+    }
+    return kind == svn_node_dir;
+}
+
+void RevisionRootCache::releaseUnused()
+{
+    while (roots.size() > maxCachedRevisionRoots) {
+        Root root = roots.takeFirst();
+        nodeKinds.remove(root.revnum);
+        svn_pool_destroy(root.pool);
+    }
+}
+
+struct DirEntry
+{
+    QByteArray name;
+    svn_node_kind_t kind;
+    int readOrder;      // position in the order FSFS stores the nodes in
+    QByteArray id;      // unparsed node-revision ID, the same for unchanged copies
+};
+typedef QVector<DirEntry> DirEntryList;  // sorted by name
+
+static bool dirEntryLessThan(const DirEntry &a, const DirEntry &b)
+{
+    return a.name < b.name;
+}
+
+static bool dirEntryReadOrderLessThan(const DirEntry &a, const DirEntry &b)
+{
+    return a.readOrder < b.readOrder;
+}
+
+static svn_error_t *readDirEntries(DirEntryList *list, apr_hash_t **direntsp, svn_fs_root_t *root,
+                                  const char *path, apr_pool_t *scratch_pool)
+{
+    apr_hash_t *dirents;
+    SVN_PROPAGATE_ERR(svn_fs_dir_entries(&dirents, root, path, scratch_pool));
+
+    list->clear();
+    list->reserve(apr_hash_count(dirents));
+    for (apr_hash_index_t *i = apr_hash_first(scratch_pool, dirents); i; i = apr_hash_next(i)) {
+        const void *vkey;
+        void *value;
+        apr_hash_this(i, &vkey, NULL, &value);
+        svn_fs_dirent_t *dirent = reinterpret_cast<svn_fs_dirent_t *>(value);
+        DirEntry entry;
+        entry.name = dirent->name;
+        entry.kind = dirent->kind;
+        entry.readOrder = 0;
+        svn_string_t *unparsed = svn_fs_unparse_id(dirent->id, scratch_pool);
+        entry.id = QByteArray(unparsed->data, unparsed->len);
+        list->append(entry);
+    }
+    std::sort(list->begin(), list->end(), dirEntryLessThan);
+
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 9
+    // remember where the entries are stored, so their contents can be read
+    // in one sweep over the rev / pack files instead of in name order
+    apr_array_header_t *ordered;
+    SVN_PROPAGATE_ERR(svn_fs_dir_optimal_order(&ordered, root, dirents, scratch_pool, scratch_pool));
+    QHash<QByteArray, int> positions;
+    for (int i = 0; i < ordered->nelts; ++i)
+        positions.insert(APR_ARRAY_IDX(ordered, i, svn_fs_dirent_t *)->name, i);
+    for (int i = 0; i < list->size(); ++i)
+        (*list)[i].readOrder = positions.value(list->at(i).name, i);
+#else
+    for (int i = 0; i < list->size(); ++i)
+        (*list)[i].readOrder = i;
+#endif
+
+    if (direntsp)
+        *direntsp = dirents;
+    return SVN_NO_ERROR;
+}
+
+/*
+ * Lists the directories below the root of a recursive export on worker
+ * threads, each with its own svn_fs_t and a pool per directory, and reads
+ * the properties of the nodes in them. The directories are listed in the
+ * order the export visits them. The export itself still walks the tree on
+ * the main thread, matching the rules and writing the files in the sorted
+ * order; it takes the listings and properties as it gets to them, so the
+ * marks and commits are the same as without the walker. The walker skips
+ * the subtrees and files the export will not get to by the same rules.
+ */
+class TreeWalker
+{
+public:
+    TreeWalker(const QString &pathToRepository, int threadCount, bool dirProps);
+    ~TreeWalker();
+
+    enum Mode {
+        ExportTree,         // all files, the subdirectories recursiveDumpDir exports to repository
+        DispatchTree,       // the entries recurse dispatches, the files only if exported
+        DirectoriesOnly     // all subdirectories, no files
+    };
+
+    // starts listing path and the directories below it
+    void walk(int revnum, const QByteArray &path, Mode mode,
+              const MatchRuleList &matchRules = MatchRuleList(), const QString &repository = QString());
+
+    // returns false if the directory has not been listed ahead, the caller
+    // must then list it itself and pass the listing to listed()
+    bool takeEntries(int revnum, const QByteArray &path, DirEntryList *entries);
+    void listed(int revnum, const QByteArray &path, const DirEntryList &entries);
+
+    // returns false if the properties of the node have not been read ahead
+    bool takeProps(const QByteArray &nodeId, NodeProps *props);
+
+    // drops everything that was not taken
+    void discard();
+
+private:
+    typedef QPair<int, QByteArray> Key;
+
+    // which entries below a walked path the export gets to
+    struct Filter
+    {
+        Mode mode;
+        MatchRuleList matchRules;
+        QString repository;
+    };
+    typedef QSharedPointer<const Filter> FilterPointer;
+    typedef QList<QPair<Key, FilterPointer> > SubdirList;
+
+    class Worker : public QThread
+    {
+        TreeWalker *walker;
+    public:
+        Worker(TreeWalker *w) : walker(w) {}
+    protected:
+        void run();
+    };
+
+    static bool walksFile(const Filter &filter, int revnum, const QByteArray &path);
+    static void subdirsToWalk(SubdirList *subdirs, const Key &key, const FilterPointer &filter,
+                              const DirEntryList &entries);
+    static svn_error_t *walkDir(DirEntryList *entries, QHash<QByteArray, NodeProps> *nodeProps,
+                                svn_fs_root_t *fs_root, const Key &key, const Filter &filter,
+                                bool dirProps, bool fileProps, apr_pool_t *pool);
+
+    bool claim(Key *key, FilterPointer *filter, bool *readProps, int *generation);
+    void finish(const Key &key, int generation, bool ok, const DirEntryList &entries,
+                const QHash<QByteArray, NodeProps> &nodeProps, const SubdirList &subdirs);
+    void queueSubdirs(const SubdirList &subdirs);
+
+    // directory entries held for the main thread, the workers wait while
+    // there are more
+    static const int maxBufferedItems = 256 * 1024;
+    // node properties held for the main thread; it never takes those of
+    // the nodes NodePropsCache still has, so the workers stop reading
+    // properties instead of waiting while there are more
+    static const int maxBufferedProps = 64 * 1024;
+
+    QString repositoryPath;
+    bool dirProps;
+
+    QMutex mutex;
+    QWaitCondition workAvailable;
+    QWaitCondition resultAvailable;
+    QList<Key> queue;           // the next directory to list is at the front
+    QSet<Key> seen;
+    QSet<Key> queued;
+    QSet<Key> listing;
+    QSet<Key> leftToCaller;     // the main thread lists these itself
+    QHash<Key, FilterPointer> filters;
+    QHash<Key, DirEntryList> done;
+    QHash<QByteArray, NodeProps> props;
+    int bufferedItems;
+    int bufferedProps;
+    int generation;
+    bool stopping;
+    QList<Worker *> workers;
+};
+
+TreeWalker::TreeWalker(const QString &pathToRepository, int threadCount, bool withDirProps)
+    : repositoryPath(pathToRepository), dirProps(withDirProps), bufferedItems(0), bufferedProps(0),
+      generation(0), stopping(false)
+{
+    for (int i = 0; i < threadCount; ++i) {
+        Worker *worker = new Worker(this);
+        workers.append(worker);
+        worker->start();
+    }
+}
+
+TreeWalker::~TreeWalker()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        workAvailable.wakeAll();
+    }
+    foreach (Worker *worker, workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+void TreeWalker::walk(int revnum, const QByteArray &path, Mode mode,
+                      const MatchRuleList &matchRules, const QString &repository)
+{
+    Key key(revnum, path);
+    QMutexLocker locker(&mutex);
+    if (seen.contains(key))
+        return;
+    Filter *filter = new Filter;
+    filter->mode = mode;
+    filter->matchRules = matchRules;
+    filter->repository = repository;
+    filters.insert(key, FilterPointer(filter));
+    seen.insert(key);
+    queue.prepend(key);
+    queued.insert(key);
+    workAvailable.wakeOne();
+}
+
+bool TreeWalker::walksFile(const Filter &filter, int revnum, const QByteArray &path)
+{
+    if (filter.mode != DispatchTree)
+        return filter.mode == ExportTree;
+    MatchRuleList::ConstIterator match = findMatchRule(filter.matchRules, revnum, QString::fromUtf8(path), NoStats);
+    return match != filter.matchRules.constEnd() && match->action == Rules::Match::Export;
+}
+
+// the subdirectories the export descends into, the same choices as
+// recursiveDumpDir and recurse make, with the filter for the entries below
+// them. The rules are matched here, outside the mutex.
+void TreeWalker::subdirsToWalk(SubdirList *subdirs, const Key &key, const FilterPointer &filter,
+                               const DirEntryList &entries)
+{
+    foreach (const DirEntry &dirent, entries) {
+        if (dirent.kind != svn_node_dir)
+            continue;
+        Key child(key.first, key.second + '/' + dirent.name);
+        FilterPointer childFilter = filter;
+        if (filter->mode != DirectoriesOnly) {
+            QString current = QString::fromUtf8(child.second) + '/';
+            MatchRuleList::ConstIterator match = findMatchRule(filter->matchRules, key.first, current, NoStats);
+            bool matched = match != filter->matchRules.constEnd();
+            if (filter->mode == ExportTree) {
+                if (!matched || match->action != Rules::Match::Export || match->repository != filter->repository)
+                    continue;
+            } else if (matched && match->action == Rules::Match::Ignore) {
+                continue;
+            } else if (matched && match->action == Rules::Match::Export) {
+                // exportInternal hands it to recursiveDumpDir
+                Filter *exported = new Filter(*filter);
+                exported->mode = ExportTree;
+                exported->repository = match->repository;
+                childFilter = FilterPointer(exported);
+            }
+        }
+        subdirs->append(qMakePair(child, childFilter));
+    }
+}
+
+// queues the subdirectories in front of everything else and in name order,
+// which is the order the export descends into them
+void TreeWalker::queueSubdirs(const SubdirList &subdirs)
+{
+    for (int i = subdirs.size() - 1; i >= 0; --i) {
+        const Key &child = subdirs.at(i).first;
+        if (seen.contains(child))
+            continue;
+        seen.insert(child);
+        filters.insert(child, subdirs.at(i).second);
+        queue.prepend(child);
+        queued.insert(child);
+    }
+    workAvailable.wakeAll();
+}
+
+bool TreeWalker::takeEntries(int revnum, const QByteArray &path, DirEntryList *entries)
+{
+    Key key(revnum, path);
+    QMutexLocker locker(&mutex);
+    if (queued.remove(key)) {
+        // not started yet, listing it right away is faster than waiting
+        queue.removeOne(key);
+        leftToCaller.insert(key);
+        return false;
+    }
+
+    while (listing.contains(key))
+        resultAvailable.wait(&mutex);
+
+    QHash<Key, DirEntryList>::Iterator it = done.find(key);
+    if (it == done.end())
+        return false;
+    *entries = it.value();
+    bufferedItems -= entries->size() + 1;
+    done.erase(it);
+    workAvailable.wakeAll();
+    return true;
+}
+
+void TreeWalker::listed(int revnum, const QByteArray &path, const DirEntryList &entries)
+{
+    Key key(revnum, path);
+    FilterPointer filter;
+    {
+        QMutexLocker locker(&mutex);
+        if (!leftToCaller.remove(key))
+            return;
+        filter = filters.value(key);
+    }
+    if (!filter)
+        return;
+
+    SubdirList subdirs;
+    subdirsToWalk(&subdirs, key, filter, entries);
+    QMutexLocker locker(&mutex);
+    queueSubdirs(subdirs);
+}
+
+bool TreeWalker::takeProps(const QByteArray &nodeId, NodeProps *nodeProps)
+{
+    QMutexLocker locker(&mutex);
+    QHash<QByteArray, NodeProps>::Iterator it = props.find(nodeId);
+    if (it == props.end())
+        return false;
+    *nodeProps = it.value();
+    --bufferedProps;
+    props.erase(it);
+    return true;
+}
+
+void TreeWalker::discard()
+{
+    QMutexLocker locker(&mutex);
+    ++generation;
+    queue.clear();
+    seen.clear();
+    queued.clear();
+    listing.clear();
+    leftToCaller.clear();
+    filters.clear();
+    done.clear();
+    props.clear();
+    bufferedItems = 0;
+    bufferedProps = 0;
+    workAvailable.wakeAll();
+}
+
+bool TreeWalker::claim(Key *key, FilterPointer *filter, bool *readProps, int *claimedGeneration)
+{
+    QMutexLocker locker(&mutex);
+    while (!stopping && (queue.isEmpty() || bufferedItems >= maxBufferedItems))
+        workAvailable.wait(&mutex);
+    if (stopping)
+        return false;
+    *key = queue.takeFirst();
+    *filter = filters.value(*key);
+    *readProps = bufferedProps < maxBufferedProps;
+    queued.remove(*key);
+    listing.insert(*key);
+    *claimedGeneration = generation;
+    return true;
+}
+
+void TreeWalker::finish(const Key &key, int claimedGeneration, bool ok, const DirEntryList &entries,
+                        const QHash<QByteArray, NodeProps> &nodeProps, const SubdirList &subdirs)
+{
+    QMutexLocker locker(&mutex);
+    if (claimedGeneration != generation)
+        return;
+    listing.remove(key);
+    if (ok) {
+        done.insert(key, entries);
+        bufferedItems += entries.size() + 1;
+        QHash<QByteArray, NodeProps>::ConstIterator it = nodeProps.constBegin();
+        for ( ; it != nodeProps.constEnd(); ++it) {
+            if (!props.contains(it.key())) {
+                props.insert(it.key(), it.value());
+                ++bufferedProps;
+            }
+        }
+        queueSubdirs(subdirs);
+    } else {
+        // the main thread lists it again and reports the error
+        leftToCaller.insert(key);
+    }
+    resultAvailable.wakeAll();
+}
+
+svn_error_t *TreeWalker::walkDir(DirEntryList *entries, QHash<QByteArray, NodeProps> *nodeProps,
+                                 svn_fs_root_t *fs_root, const Key &key, const Filter &filter,
+                                 bool dirProps, bool fileProps, apr_pool_t *pool)
+{
+    const QByteArray &path = key.second;
+    apr_hash_t *dirents;
+    SVN_PROPAGATE_ERR(readDirEntries(entries, &dirents, fs_root, path, pool));
+
+    NodeProps props;
+    if (dirProps) {
+        const svn_fs_id_t *id;
+        SVN_PROPAGATE_ERR(svn_fs_node_id(&id, fs_root, path, pool));
+        svn_string_t *unparsed = svn_fs_unparse_id(id, pool);
+        SVN_PROPAGATE_ERR(readNodeProps(&props, fs_root, path, pool));
+        nodeProps->insert(QByteArray(unparsed->data, unparsed->len), props);
+    }
+
+    if (!fileProps || filter.mode == DirectoriesOnly)
+        return SVN_NO_ERROR;
+
+    // dumpBlob needs the properties of every file it writes
+    for (apr_hash_index_t *i = apr_hash_first(pool, dirents); i; i = apr_hash_next(i)) {
+        const void *vkey;
+        void *value;
+        apr_hash_this(i, &vkey, NULL, &value);
+        svn_fs_dirent_t *dirent = reinterpret_cast<svn_fs_dirent_t *>(value);
+        if (dirent->kind != svn_node_file)
+            continue;
+        QByteArray child = path + '/' + dirent->name;
+        if (!walksFile(filter, key.first, child))
+            continue;
+        svn_string_t *unparsed = svn_fs_unparse_id(dirent->id, pool);
+        SVN_PROPAGATE_ERR(readNodeProps(&props, fs_root, child, pool));
+        nodeProps->insert(QByteArray(unparsed->data, unparsed->len), props);
+    }
+    return SVN_NO_ERROR;
+}
+
+void TreeWalker::Worker::run()
+{
+    AprAutoPool pool;
+    svn_fs_t *fs = NULL;
+    if (openFs(&fs, walker->repositoryPath, pool, pool) != EXIT_SUCCESS)
+        fs = NULL;
+
+    // keep the root of the revision being walked open between directories
+    AprAutoPool rootpool(pool.data());
+    svn_fs_root_t *fs_root = NULL;
+    int root_revnum = -1;
+
+    AprAutoPool dirpool(pool.data());
+    Key key;
+    FilterPointer filter;
+    bool readProps;
+    int generation;
+    while (walker->claim(&key, &filter, &readProps, &generation)) {
+        dirpool.clear();
+        DirEntryList entries;
+        QHash<QByteArray, NodeProps> nodeProps;
+        SubdirList subdirs;
+        bool ok = false;
+        if (fs) {
+            if (key.first != root_revnum) {
+                rootpool.clear();
+                fs_root = NULL;
+                svn_error_t *err = svn_fs_revision_root(&fs_root, fs, key.first, rootpool);
+                if (err) {
+                    svn_error_clear(err);
+                    fs_root = NULL;
+                }
+                root_revnum = key.first;
+            }
+            if (fs_root && filter) {
+                svn_error_t *err = walkDir(&entries, &nodeProps, fs_root, key, *filter,
+                                           walker->dirProps && readProps, readProps, dirpool);
+                ok = !err;
+                svn_error_clear(err);
+                if (ok)
+                    subdirsToWalk(&subdirs, key, filter, entries);
+            }
+        }
+        walker->finish(key, generation, ok, entries, nodeProps, subdirs);
+    }
+}
+
+svn_error_t *NodePropsCache::props(NodeProps *props, svn_fs_root_t *root, const char *path,
+                                   apr_pool_t *scratch_pool)
+{
+    const svn_fs_id_t *id;
+    SVN_PROPAGATE_ERR(svn_fs_node_id(&id, root, path, scratch_pool));
+    svn_string_t *unparsed = svn_fs_unparse_id(id, scratch_pool);
+    QByteArray key(unparsed->data, unparsed->len);
+
+    if (const NodeProps *cached = cache.object(key)) {
+        Stats::instance()->cacheHit("node properties");
+        *props = *cached;
+        return SVN_NO_ERROR;
+    }
+
+    Stats::instance()->cacheMiss("node properties");
+    NodeProps result;
+    if (!walker || !walker->takeProps(key, &result))
+        SVN_PROPAGATE_ERR(readNodeProps(&result, root, path, scratch_pool));
+
+    int cost = key.size() + 64;
+    for (NodeProps::ConstIterator it = result.constBegin(); it != result.constEnd(); ++it)
+        cost += it.key().size() + it.value().size() + 64;
+
+    *props = result;
+    cache.insert(key, new NodeProps(result), cost);
+    return SVN_NO_ERROR;
+}
+
+/*
+ * Directory listings by revision and path, shared by the walkers of the
+ * empty-dirs and svn-ignore code and the recursive exports. The listings
+ * are sorted by name, so iterating them gives the same order as before
+ * and the git commit hashes do not change.
+ */
+class DirEntriesCache
+{
+public:
+    DirEntriesCache(int maxBytes, TreeWalker *w) : walker(w), cache(maxBytes) {}
+
+    svn_error_t *entries(DirEntryList *list, svn_fs_root_t *root, const char *path, apr_pool_t *scratch_pool);
+
+private:
+    typedef QPair<int, QByteArray> Key;
+    TreeWalker *walker;
+    QCache<Key, DirEntryList> cache;
+};
+
+svn_error_t *DirEntriesCache::entries(DirEntryList *list, svn_fs_root_t *root, const char *path,
+                                      apr_pool_t *scratch_pool)
+{
+    Key key(svn_fs_revision_root_revision(root), QByteArray(path));
+    if (const DirEntryList *cached = cache.object(key)) {
+        Stats::instance()->cacheHit("directory listing");
+        *list = *cached;
+        return SVN_NO_ERROR;
+    }
+
+    Stats::instance()->cacheMiss("directory listing");
+    DirEntryList result;
+    if (!walker || !walker->takeEntries(key.first, key.second, &result)) {
+        SVN_PROPAGATE_ERR(readDirEntries(&result, NULL, root, path, scratch_pool));
+        if (walker)
+            walker->listed(key.first, key.second, result);
+    }
+
+    int cost = key.second.size() + int(sizeof(DirEntryList));
+    foreach (const DirEntry &entry, result)
+        cost += entry.name.size() + entry.id.size() + int(sizeof(DirEntry)) + 48;
+
+    *list = result;
+    cache.insert(key, new DirEntryList(result), cost);
+    return SVN_NO_ERROR;
+}
+
+/*
+ * The number of entries of the directories the empty-dirs code asked
+ * about, as a tree of the directories below the repository root. The
+ * counts describe the revision before the one being exported. They are
+ * carried from revision to revision by applying the changed paths, so a
+ * directory is only listed the first time it is asked about, or again
+ * after it was added, replaced or deleted.
+ */
+class DirOccupancy
+{
+public:
+    DirOccupancy() : modelRevision(-1), currentRevision(-1) {}
+    ~DirOccupancy() { clearNode(&root); }
+
+    // starts exporting revnum, whose changed paths are changes
+    void begin(int revnum, const PathChangeList &changes);
+    // applies the changes of the revision begun last to the counts
+    void finish();
+
+    // returns false if the count is not known, the caller must then list
+    // the directory itself and pass the count to setEntryCount()
+    bool entryCount(int revnum, const QByteArray &path, int *count);
+    void setEntryCount(int revnum, const QByteArray &path, int count);
+
+private:
+    struct Node
+    {
+        int count;      // -1 if not known
+        QHash<QByteArray, Node *> subdirs;
+        Node() : count(-1) {}
+    };
+
+    static QByteArray cleanPath(const QByteArray &path);
+    static QByteArray parentPath(const QByteArray &path);
+    static void clearNode(Node *node);
+    Node *find(const QByteArray &path, bool create);
+    void remove(const QByteArray &path);
+    bool changedBelow(const QByteArray &path) const;
+
+    Node root;
+    int modelRevision;
+    int currentRevision;
+    QHash<QByteArray, int> delta;   // entries added minus entries deleted
+    QSet<QByteArray> changedDirs;   // added, replaced or deleted
+};
+
+QByteArray DirOccupancy::cleanPath(const QByteArray &path)
+{
+    QByteArray clean = path;
+    while (clean.endsWith('/'))
+        clean.chop(1);
+    return clean;
+}
+
+QByteArray DirOccupancy::parentPath(const QByteArray &path)
+{
+    int index = path.lastIndexOf('/');
+    return index == -1 ? QByteArray() : path.left(index);
+}
+
+void DirOccupancy::clearNode(Node *node)
+{
+    foreach (Node *subdir, node->subdirs) {
+        clearNode(subdir);
+        delete subdir;
+    }
+    node->subdirs.clear();
+    node->count = -1;
+}
+
+DirOccupancy::Node *DirOccupancy::find(const QByteArray &path, bool create)
+{
+    Node *node = &root;
+    foreach (const QByteArray &name, path.split('/')) {
+        if (name.isEmpty())
+            continue;
+        Node *subdir = node->subdirs.value(name);
+        if (!subdir) {
+            if (!create)
+                return NULL;
+            subdir = new Node;
+            node->subdirs.insert(name, subdir);
+        }
+        node = subdir;
+    }
+    return node;
+}
+
+void DirOccupancy::remove(const QByteArray &path)
+{
+    Node *parent = find(parentPath(path), false);
+    if (!parent)
+        return;
+    QByteArray name = path.mid(path.lastIndexOf('/') + 1);
+    Node *node = parent->subdirs.take(name);
+    if (node) {
+        clearNode(node);
+        delete node;
+    }
+}
+
+// true if the directory or one of its parents is changed as a whole in
+// the current revision, the counts of the previous revision do not apply
+bool DirOccupancy::changedBelow(const QByteArray &path) const
+{
+    for (QByteArray dir = path; !dir.isEmpty(); dir = parentPath(dir)) {
+        if (changedDirs.contains(dir))
+            return true;
+    }
+    return false;
+}
+
+void DirOccupancy::begin(int revnum, const PathChangeList &changes)
+{
+    if (modelRevision != revnum - 1) {
+        // a revision was not applied, start over
+        clearNode(&root);
+        modelRevision = revnum - 1;
+    }
+    currentRevision = revnum;
+    delta.clear();
+    changedDirs.clear();
+
+    foreach (const PathChange &change, changes) {
+        QByteArray path = cleanPath(change.path);
+        switch (change.change_kind) {
+        case svn_fs_path_change_add:
+            ++delta[parentPath(path)];
+            changedDirs.insert(path);
+            break;
+        case svn_fs_path_change_delete:
+            --delta[parentPath(path)];
+            changedDirs.insert(path);
+            break;
+        case svn_fs_path_change_modify:
+            break;
+        default:
+            changedDirs.insert(path);
+            break;
+        }
+    }
+}
+
+void DirOccupancy::finish()
+{
+    if (currentRevision != modelRevision + 1)
+        return;
+
+    QHash<QByteArray, int>::ConstIterator it = delta.constBegin();
+    for ( ; it != delta.constEnd(); ++it) {
+        Node *node = find(it.key(), false);
+        if (node && node->count >= 0)
+            node->count += it.value();
+    }
+    foreach (const QByteArray &path, changedDirs)
+        remove(path);
+
+    modelRevision = currentRevision;
+    delta.clear();
+    changedDirs.clear();
+}
+
+bool DirOccupancy::entryCount(int revnum, const QByteArray &path, int *count)
+{
+    QByteArray clean = cleanPath(path);
+    bool current = revnum == currentRevision && currentRevision == modelRevision + 1;
+    if (revnum != modelRevision && !current)
+        return false;
+    if (current && changedBelow(clean))
+        return false;
+
+    Node *node = find(clean, false);
+    if (!node || node->count < 0) {
+        Stats::instance()->cacheMiss("directory occupancy");
+        return false;
+    }
+
+    Stats::instance()->cacheHit("directory occupancy");
+    *count = node->count;
+    if (current)
+        *count += delta.value(clean);
+    return true;
+}
+
+void DirOccupancy::setEntryCount(int revnum, const QByteArray &path, int count)
+{
+    QByteArray clean = cleanPath(path);
+    if (revnum == modelRevision) {
+        find(clean, true)->count = count;
+    } else if (revnum == currentRevision && currentRevision == modelRevision + 1 && !changedBelow(clean)) {
+        find(clean, true)->count = count - delta.value(clean);
+    }
+}
+
+time_t get_epoch(const char* svn_date)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof tm);
+    QByteArray date(svn_date, strlen(svn_date) - 8);
+    strptime(date, "%Y-%m-%dT%H:%M:%S", &tm);
+    return timegm(&tm);
+}
+
+static bool changeLessThan(const PathChange &change, const PathChange &other)
+{
+    return change.path < other.path;
+}
+
+static bool changePathLessThan(const PathChange &change, const QByteArray &path)
+{
+    return change.path < path;
+}
+
+static const PathChange *findChange(const PathChangeList &changes, const QByteArray &path)
+{
+    PathChangeList::ConstIterator it =
+        std::lower_bound(changes.constBegin(), changes.constEnd(), path, changePathLessThan);
+    if (it == changes.constEnd() || it->path != path)
+        return NULL;
+    return &*it;
+}
+
+/*
+ * Classifies one change record. Node kind and copy source are taken from the
+ * record itself, the filesystem is only asked if the backend did not store
+ * them (node_kind == svn_node_unknown or !copyfrom_known).
+ */
+static int classifyChange(PathChange *pathChange, const char *path, svn_fs_path_change_kind_t change_kind,
+                          svn_node_kind_t node_kind, svn_boolean_t text_mod, svn_boolean_t prop_mod,
+                          svn_boolean_t copyfrom_known, svn_revnum_t copyfrom_rev, const char *copyfrom_path,
+                          svn_fs_t *fs, svn_fs_root_t *fs_root, int revnum, apr_pool_t *pool)
+{
+    pathChange->path = path;
+    pathChange->change_kind = change_kind;
+    pathChange->text_mod = text_mod;
+    pathChange->prop_mod = prop_mod;
+    pathChange->copyfrom_rev = SVN_INVALID_REVNUM;
+    pathChange->is_dir = false;
+    pathChange->was_dir = false;
+
+    if (change_kind == svn_fs_path_change_delete) {
+        // the path no longer exists in the current revision, the recorded
+        // kind is the one of the deleted node
+        if (node_kind == svn_node_unknown)
+            pathChange->was_dir = wasDir(fs, revnum - 1, path, pool);
+        else
+            pathChange->was_dir = node_kind == svn_node_dir;
+        return EXIT_SUCCESS;
+    }
+
+    // was this copied from somewhere?
+    if (!copyfrom_known)
+        SVN_ERR(svn_fs_copied_from(&copyfrom_rev, &copyfrom_path, fs_root, path, pool));
+    if (copyfrom_path) {
+        pathChange->copyfrom_path = copyfrom_path;
+        pathChange->copyfrom_rev = copyfrom_rev;
+    }
+
+    // is this a directory?
+    if (node_kind == svn_node_unknown)
+        SVN_ERR(svn_fs_check_path(&node_kind, fs_root, path, pool));
+    pathChange->is_dir = node_kind == svn_node_dir;
+
+    return EXIT_SUCCESS;
+}
+
+static int fetchChanges(RevisionInfo *info, svn_fs_t *fs, svn_fs_root_t *fs_root, apr_pool_t *pool)
+{
+    // find out what was changed in this revision:
+    AprAutoPool changepool(pool);
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 10
+    svn_fs_path_change_iterator_t *iterator;
+    SVN_ERR(svn_fs_paths_changed3(&iterator, fs_root, pool, pool));
+
+    svn_fs_path_change3_t *change;
+    SVN_ERR(svn_fs_path_change_get(&change, iterator));
+    while (change) {
+        changepool.clear();
+        PathChange pathChange;
+        if (classifyChange(&pathChange, change->path.data, change->change_kind, change->node_kind,
+                           change->text_mod, change->prop_mod, change->copyfrom_known,
+                           change->copyfrom_rev, change->copyfrom_path,
+                           fs, fs_root, info->revnum, changepool) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        info->changes.append(pathChange);
+        SVN_ERR(svn_fs_path_change_get(&change, iterator));
+    }
+#else
+    apr_hash_t *changes;
+    SVN_ERR(svn_fs_paths_changed2(&changes, fs_root, pool));
+
+    info->changes.reserve(apr_hash_count(changes));
+    for (apr_hash_index_t *i = apr_hash_first(pool, changes); i; i = apr_hash_next(i)) {
+        changepool.clear();
+        const void *vkey;
+        void *value;
+        apr_hash_this(i, &vkey, NULL, &value);
+        const char *key = reinterpret_cast<const char *>(vkey);
+        svn_fs_path_change2_t *change = reinterpret_cast<svn_fs_path_change2_t *>(value);
+        PathChange pathChange;
+        if (classifyChange(&pathChange, key, change->change_kind, change->node_kind,
+                           change->text_mod, change->prop_mod, change->copyfrom_known,
+                           change->copyfrom_rev, change->copyfrom_path,
+                           fs, fs_root, info->revnum, changepool) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        info->changes.append(pathChange);
+    }
+#endif
+
+    // Export in sorted order, so we can repeat the conversions and get the
+    // same git commit hashes.
+    std::sort(info->changes.begin(), info->changes.end(), changeLessThan);
+
+    for (int i = 1; i < info->changes.size(); ++i) {
+        // If we mix path deletions with path adds/replaces we might erase a
+        // branch after that it has been reset -> history truncated
+        if (info->changes.at(i).path == info->changes.at(i - 1).path) {
+            // If the same path is deleted and added, we need to put the
+            // deletions into the list first, then the addition.
+            fprintf(stderr, "\nDuplicate key found in rev %d: %s\n", info->revnum,
+                    info->changes.at(i).path.constData());
+            fprintf(stderr, "This needs more code to be handled, file a bug report\n");
+            fflush(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int fetchRevisionProps(RevisionInfo *info, svn_fs_t *fs, apr_pool_t *pool)
+{
+    apr_hash_t *revprops;
+    SVN_ERR(svn_fs_revision_proplist(&revprops, fs, info->revnum, pool));
+    svn_string_t *svnauthor = (svn_string_t*)apr_hash_get(revprops, "svn:author", APR_HASH_KEY_STRING);
+    svn_string_t *svndate = (svn_string_t*)apr_hash_get(revprops, "svn:date", APR_HASH_KEY_STRING);
+    svn_string_t *svnlog = (svn_string_t*)apr_hash_get(revprops, "svn:log", APR_HASH_KEY_STRING);
+
+    info->author = svnauthor ? QByteArray(svnauthor->data) : QByteArray();
+    info->date = svndate ? QByteArray(svndate->data) : QByteArray();
+    info->log = svnlog ? QByteArray(svnlog->data) : QByteArray();
+    info->revpropsFetched = true;
+    return EXIT_SUCCESS;
+}
+
+static int prefetchRevision(RevisionInfo *info, svn_fs_t *fs, bool revprops, apr_pool_t *pool)
+{
+    svn_fs_root_t *fs_root;
+    SVN_ERR(svn_fs_revision_root(&fs_root, fs, info->revnum, pool));
+    if (fetchChanges(info, fs, fs_root, pool) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    if (!revprops)
+        return EXIT_SUCCESS;
+    return fetchRevisionProps(info, fs, pool);
+}
+
+/*
+ * An append-only file with the changed paths of each revision, so that a
+ * run can decide which revisions matter before it opens them. The file is
+ * mapped into memory; records of revisions indexed during this run are
+ * appended and picked up by remapping. A record is
+ *
+ *   revision (qint32), payload length (quint32), payload
+ *
+ * with the payload written by QDataStream. A truncated last record, say
+ * from an interrupted run, is cut off when the file is opened.
+ */
+class ChangesIndex
+{
+public:
+    ChangesIndex(const QString &fileName, const QByteArray &uuid);
+    ~ChangesIndex();
+
+    bool contains(int revnum) const;
+    bool changes(int revnum, PathChangeList *changes);
+    void append(int revnum, const PathChangeList &changes);
+    void flush();
+
+private:
+    bool map();
+
+    QFile file;
+    QByteArray header;
+    uchar *data;
+    qint64 mappedSize;
+    QVector<qint64> offsets;    // by revision, -1 if not indexed
+};
+
+ChangesIndex::ChangesIndex(const QString &fileName, const QByteArray &uuid)
+    : file(fileName), data(0), mappedSize(0)
+{
+    header = "svn-all-fast-export changes index 1\n" + uuid + "\n";
+    if (!file.open(QIODevice::ReadWrite)) {
+        qWarning() << "WARN: Cannot open changes index" << fileName << ":" << file.errorString();
+        return;
+    }
+
+    if (file.size() < header.size() || file.read(header.size()) != header) {
+        // new, or made for another repository
+        file.resize(0);
+        file.write(header);
+        file.flush();
+        return;
+    }
+
+    if (!map())
+        return;
+    qint64 pos = header.size();
+    while (pos + 8 <= mappedSize) {
+        qint32 revnum = qFromBigEndian<qint32>(data + pos);
+        quint32 length = qFromBigEndian<quint32>(data + pos + 4);
+        if (revnum < 0 || pos + 8 + length > mappedSize)
+            break;
+        while (offsets.size() <= revnum)
+            offsets.append(-1);
+        offsets[revnum] = pos;
+        pos += 8 + length;
+    }
+    if (pos != file.size()) {
+        qWarning() << "WARN: Truncating changes index" << fileName << "after an incomplete record";
+        file.unmap(data);
+        data = 0;
+        file.resize(pos);
+        map();
+    }
+    // append() writes at the current position
+    file.seek(file.size());
+}
+
+ChangesIndex::~ChangesIndex()
+{
+    if (data)
+        file.unmap(data);
+}
+
+bool ChangesIndex::map()
+{
+    if (data)
+        file.unmap(data);
+    mappedSize = file.size();
+    data = file.map(0, mappedSize);
+    return data != 0;
+}
+
+bool ChangesIndex::contains(int revnum) const
+{
+    return revnum >= 0 && revnum < offsets.size() && offsets.at(revnum) >= 0;
+}
+
+bool ChangesIndex::changes(int revnum, PathChangeList *changes)
+{
+    if (!contains(revnum))
+        return false;
+    qint64 pos = offsets.at(revnum);
+    if (pos + 8 > mappedSize && !map())
+        return false;
+    quint32 length = qFromBigEndian<quint32>(data + pos + 4);
+    if (pos + 8 + length > mappedSize && !map())
+        return false;
+
+    QByteArray payload = QByteArray::fromRawData(reinterpret_cast<const char *>(data + pos + 8), length);
+    QDataStream stream(payload);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 count;
+    stream >> count;
+    changes->clear();
+    changes->reserve(count);
+    for (quint32 i = 0; i < count; ++i) {
+        PathChange change;
+        quint8 kind, flags;
+        qint32 copyfrom_rev;
+        stream >> change.path >> kind >> flags >> change.copyfrom_path >> copyfrom_rev;
+        change.change_kind = svn_fs_path_change_kind_t(kind);
+        change.text_mod = (flags & 0x01) != 0;
+        change.prop_mod = (flags & 0x02) != 0;
+        change.is_dir = (flags & 0x04) != 0;
+        change.was_dir = (flags & 0x08) != 0;
+        change.copyfrom_rev = copyfrom_rev;
+        changes->append(change);
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+void ChangesIndex::append(int revnum, const PathChangeList &changes)
+{
+    if (!file.isOpen() || contains(revnum))
+        return;
+
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint32(changes.size());
+    foreach (const PathChange &change, changes) {
+        quint8 flags = (change.text_mod ? 0x01 : 0) | (change.prop_mod ? 0x02 : 0)
+            | (change.is_dir ? 0x04 : 0) | (change.was_dir ? 0x08 : 0);
+        stream << change.path << quint8(change.change_kind) << flags
+               << change.copyfrom_path << qint32(change.copyfrom_rev);
+    }
+
+    uchar recordHeader[8];
+    qToBigEndian<qint32>(revnum, recordHeader);
+    qToBigEndian<quint32>(payload.size(), recordHeader + 4);
+    // without a flush, size() would write out the buffer for every record
+    qint64 pos = file.pos();
+    file.write(reinterpret_cast<const char *>(recordHeader), sizeof(recordHeader));
+    file.write(payload);
+
+    while (offsets.size() <= revnum)
+        offsets.append(-1);
+    offsets[revnum] = pos;
+}
+
+void ChangesIndex::flush()
+{
+    if (file.isOpen())
+        file.flush();
+}
+
+/*
+ * Prepares the RevisionInfo of upcoming revisions on worker threads, each
+ * with its own svn_fs_t and pool, while the main thread is busy exporting.
+ * At most 'lookahead' revisions beyond the one being exported are prepared.
+ */
+class RevisionPrefetcher
+{
+public:
+    // without revprops only the changed paths are fetched
+    RevisionPrefetcher(const QString &pathToRepository, const QList<int> &revisions,
+                       int lookahead, int threadCount, bool revprops = true);
+    ~RevisionPrefetcher();
+
+    // returns false if revnum has not been prefetched, the caller must then
+    // fetch it itself; the results of revisions before revnum are discarded
+    bool take(int revnum, RevisionInfo *info);
+
+private:
+    class Worker : public QThread
+    {
+        RevisionPrefetcher *prefetcher;
+    public:
+        Worker(RevisionPrefetcher *p) : prefetcher(p) {}
+    protected:
+        void run();
+    };
+
+    bool claim(int *index);
+    void finish(int index, RevisionInfo *info);
+
+    QString repositoryPath;
+    QList<int> revisions;
+    int lookahead;
+    bool revprops;
+
+    QMutex mutex;
+    QWaitCondition workAvailable;
+    QWaitCondition resultAvailable;
+    int nextIndex;
+    int takenIndex;
+    int waitingIndex;
+    bool stopping;
+    QHash<int, RevisionInfo *> results;  // a null RevisionInfo means failure
+    QList<Worker *> workers;
+};
+
+RevisionPrefetcher::RevisionPrefetcher(const QString &pathToRepository, const QList<int> &revs,
+                                       int ahead, int threadCount, bool withRevprops)
+    : repositoryPath(pathToRepository), revisions(revs), lookahead(ahead), revprops(withRevprops),
+      nextIndex(0), takenIndex(0), waitingIndex(-1), stopping(false)
+{
+    for (int i = 0; i < threadCount; ++i) {
+        Worker *worker = new Worker(this);
+        workers.append(worker);
+        worker->start();
+    }
+}
+
+RevisionPrefetcher::~RevisionPrefetcher()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        workAvailable.wakeAll();
+    }
+    foreach (Worker *worker, workers) {
+        worker->wait();
+        delete worker;
+    }
+    qDeleteAll(results);
+}
+
+bool RevisionPrefetcher::claim(int *index)
+{
+    QMutexLocker locker(&mutex);
+    while (!stopping && (nextIndex >= revisions.size() || nextIndex >= takenIndex + lookahead))
+        workAvailable.wait(&mutex);
+    if (stopping)
+        return false;
+    *index = nextIndex++;
+    return true;
+}
+
+void RevisionPrefetcher::finish(int index, RevisionInfo *info)
+{
+    QMutexLocker locker(&mutex);
+    if (index < takenIndex && index != waitingIndex) {
+        // the revision was skipped while it was being fetched
+        delete info;
+        return;
+    }
+    results.insert(revisions.at(index), info);
+    resultAvailable.wakeAll();
+}
+
+bool RevisionPrefetcher::take(int revnum, RevisionInfo *info)
+{
+    QMutexLocker locker(&mutex);
+    // the caller did not ask for some revisions, so they would hold up the
+    // window forever
+    while (takenIndex < revisions.size() && revisions.at(takenIndex) < revnum) {
+        delete results.take(revisions.at(takenIndex));
+        ++takenIndex;
+        workAvailable.wakeAll();
+    }
+    if (takenIndex >= revisions.size() || revisions.at(takenIndex) != revnum)
+        return false;
+
+    // move the window, so the workers can start on the next revision already
+    waitingIndex = takenIndex++;
+    workAvailable.wakeAll();
+
+    while (!results.contains(revnum))
+        resultAvailable.wait(&mutex);
+    waitingIndex = -1;
+
+    RevisionInfo *result = results.take(revnum);
+    if (!result)
+        return false;
+    *info = *result;
+    delete result;
+    return true;
+}
+
+void RevisionPrefetcher::Worker::run()
+{
+    AprAutoPool pool;
+    svn_fs_t *fs = NULL;
+    if (openFs(&fs, prefetcher->repositoryPath, pool, pool) != EXIT_SUCCESS)
+        fs = NULL;
+
+    AprAutoPool revpool(pool.data());
+    int index;
+    while (prefetcher->claim(&index)) {
+        revpool.clear();
+        RevisionInfo *info = NULL;
+        if (fs) {
+            info = new RevisionInfo;
+            info->revnum = prefetcher->revisions.at(index);
+            if (prefetchRevision(info, fs, prefetcher->revprops, revpool) != EXIT_SUCCESS) {
+                // let the main thread retry and report the error
+                delete info;
+                info = NULL;
+            }
+        }
+        prefetcher->finish(index, info);
+    }
+}
+
+void SvnPrivate::startPrefetch(const QList<int> &revisions, int lookahead)
+{
+    delete prefetcher;
+    // exportRevision does not ask for the revisions it skips
+    QList<int> exported;
+    foreach (int revnum, revisions) {
+        if (touchesExportedPath(revnum))
+            exported.append(revnum);
+    }
+    int threadCount = qMax(1, qMin(lookahead, QThread::idealThreadCount()));
+    prefetcher = new RevisionPrefetcher(repositoryPath, exported, lookahead, threadCount);
+}
+
+void SvnPrivate::updateChangesIndex()
+{
+    QList<int> missing;
+    for (int revnum = 1; revnum <= youngest_rev; ++revnum) {
+        if (!changesIndex->contains(revnum))
+            missing.append(revnum);
+    }
+    if (missing.isEmpty())
+        return;
+
+    printf("Indexing the changed paths of %d revisions\n", missing.size());
+    fflush(stdout);
+    int threadCount = qMax(1, QThread::idealThreadCount());
+    RevisionPrefetcher scanner(repositoryPath, missing, 4 * threadCount, threadCount, false);
+    AprAutoPool pool(global_pool.data());
+    foreach (int revnum, missing) {
+        RevisionInfo info;
+        if (!scanner.take(revnum, &info)) {
+            pool.clear();
+            info.revnum = revnum;
+            svn_fs_root_t *fs_root;
+            svn_error_t *err = svn_fs_revision_root(&fs_root, fs, revnum, pool);
+            if (err || fetchChanges(&info, fs, fs_root, pool) != EXIT_SUCCESS) {
+                svn_error_clear(err);
+                qWarning() << "WARN: Cannot index revision" << revnum << ", the index stops before it";
+                break;
+            }
+        }
+        changesIndex->append(revnum, info.changes);
+    }
+    changesIndex->flush();
+}
+
+// true unless every changed path of the revision is ignored by all the
+// rules files, in which case exporting the revision would not do anything
+static bool onlyIgnoredChanges(const QList<MatchRuleList> &allMatchRules, int revnum,
+                               const PathChangeList &changes, int ruleMask)
+{
+    bool dirsMatter = CommandLineParser::instance()->contains("empty-dirs")
+        || CommandLineParser::instance()->contains("svn-ignore");
+    foreach (const PathChange &change, changes) {
+        if (change.is_dir && change.copyfrom_path.isNull()
+                && change.change_kind != svn_fs_path_change_delete) {
+            // exportEntry commits these even if no rule exports them
+            if (dirsMatter)
+                return false;
+            // Git doesn't handle directories
+            if (change.change_kind == svn_fs_path_change_add
+                    || change.change_kind == svn_fs_path_change_modify)
+                continue;
+        }
+        if (change.change_kind == svn_fs_path_change_reset)
+            return false;
+
+        QString current = QString::fromUtf8(change.path);
+        if (change.is_dir || (change.change_kind == svn_fs_path_change_delete && change.was_dir))
+            current += '/';
+        foreach (const MatchRuleList &matchRules, allMatchRules) {
+            MatchRuleList::ConstIterator match = findMatchRule(matchRules, revnum, current, ruleMask);
+            if (match == matchRules.constEnd() || match->action != Rules::Match::Ignore)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool SvnPrivate::touchesExportedPath(int revnum)
+{
+    if (!changesIndex)
+        return true;
+
+    QHash<int, bool>::ConstIterator it = exportedPathTouched.constFind(revnum);
+    if (it != exportedPathTouched.constEnd())
+        return it.value();
+
+    PathChangeList changes;
+    bool touched = !changesIndex->changes(revnum, &changes)
+        || !onlyIgnoredChanges(allMatchRules, revnum, changes, NoStats);
+    exportedPathTouched.insert(revnum, touched);
+    return touched;
+}
+
+/*
+ * Tells the kernel which parts of db/revs the next revisions will be read
+ * from, and which parts the revisions behind us were read from. Revisions
+ * in a pack file are assumed to take an equal share of it; that is not
+ * exact, but the window covers enough revisions for it not to matter.
+ */
+class ReadaheadPlanner
+{
+public:
+    ReadaheadPlanner(const QString &pathToRepository, int youngest, int window);
+
+    void advance(int revnum);
+
+private:
+    struct Segment
+    {
+        int revnum;
+        QByteArray file;
+        qint64 offset;
+        qint64 length;      // 0 for the whole file
+    };
+
+    void readLayout();
+    void readYoungest();
+    bool segment(Segment *segment, int revnum);
+    qint64 advise(const Segment &segment, int advice);
+    void updateStats();
+
+    QString dbPath;
+    int shardSize;          // 0 for a linear layout
+    int minUnpackedRev;
+    int youngest;
+    int window;
+    int nextRevision;       // the first revision not advised yet
+    QList<Segment> advised;
+    qint64 bytesAdvised;
+    qint64 initialBytesRead;
+    bool stats;
+};
+
+static qint64 storageBytesRead()
+{
+    QFile io("/proc/self/io");
+    if (!io.open(QIODevice::ReadOnly))
+        return -1;
+    foreach (const QByteArray &line, io.readAll().split('\n')) {
+        if (line.startsWith("read_bytes:"))
+            return line.mid(strlen("read_bytes:")).trimmed().toLongLong();
+    }
+    return -1;
+}
+
+ReadaheadPlanner::ReadaheadPlanner(const QString &pathToRepository, int youngestRevision, int revisions)
+    : dbPath(pathToRepository + "/db/"), shardSize(0), minUnpackedRev(0), youngest(youngestRevision),
+      window(revisions), nextRevision(0), bytesAdvised(0)
+{
+    readLayout();
+    stats = CommandLineParser::instance()->contains(QLatin1String("stats"));
+    initialBytesRead = stats ? storageBytesRead() : -1;
+}
+
+void ReadaheadPlanner::readLayout()
+{
+    QFile format(dbPath + "format");
+    if (format.open(QIODevice::ReadOnly)) {
+        foreach (const QByteArray &line, format.readAll().split('\n')) {
+            if (line.startsWith("layout sharded "))
+                shardSize = line.mid(strlen("layout sharded ")).trimmed().toInt();
+        }
+    }
+
+    QFile minUnpacked(dbPath + "min-unpacked-rev");
+    if (minUnpacked.open(QIODevice::ReadOnly))
+        minUnpackedRev = minUnpacked.readAll().trimmed().toInt();
+}
+
+// with --dump the loader keeps adding revisions during the export
+void ReadaheadPlanner::readYoungest()
+{
+    QFile current(dbPath + "current");
+    if (current.open(QIODevice::ReadOnly)) {
+        // older formats have the next node and copy ids after the revision
+        QList<QByteArray> fields = current.readLine().trimmed().split(' ');
+        bool ok;
+        int revnum = fields.first().toInt(&ok);
+        if (ok)
+            youngest = qMax(youngest, revnum);
+    }
+}
+
+bool ReadaheadPlanner::segment(Segment *segment, int revnum)
+{
+    segment->revnum = revnum;
+    segment->offset = 0;
+    segment->length = 0;
+    if (shardSize <= 0) {
+        segment->file = QFile::encodeName(dbPath + "revs/" + QString::number(revnum));
+        return true;
+    }
+
+    int shard = revnum / shardSize;
+    if (revnum >= minUnpackedRev) {
+        segment->file = QFile::encodeName(dbPath + QString("revs/%1/%2").arg(shard).arg(revnum));
+        if (QFile::exists(segment->file))
+            return true;
+        // the shard may have been packed since we looked
+        readLayout();
+        if (revnum >= minUnpackedRev)
+            return false;
+    }
+
+    segment->file = QFile::encodeName(dbPath + QString("revs/%1.pack/pack").arg(shard));
+    struct stat st;
+    if (stat(segment->file.constData(), &st) != 0)
+        return false;
+    qint64 share = st.st_size / shardSize + 1;
+    segment->offset = share * (revnum - shard * shardSize);
+    segment->length = share;
+    return true;
+}
+
+qint64 ReadaheadPlanner::advise(const Segment &segment, int advice)
+{
+    int fd = ::open(segment.file.constData(), O_RDONLY);
+    if (fd < 0)
+        return 0;
+    qint64 length = segment.length;
+    if (length == 0) {
+        struct stat st;
+        length = fstat(fd, &st) == 0 ? st.st_size : 0;
+    }
+    posix_fadvise(fd, segment.offset, segment.length, advice);
+    ::close(fd);
+    return length;
+}
+
+void ReadaheadPlanner::advance(int revnum)
+{
+    if (revnum + window > youngest)
+        readYoungest();
+    int last = qMin(revnum + window, youngest);
+    for (int r = qMax(nextRevision, revnum); r <= last; ++r) {
+        Segment next;
+        if (!segment(&next, r))
+            continue;
+        bytesAdvised += advise(next, POSIX_FADV_WILLNEED);
+        advised.append(next);
+    }
+    nextRevision = qMax(nextRevision, last + 1);
+
+    while (!advised.isEmpty() && advised.first().revnum < revnum - window)
+        advise(advised.takeFirst(), POSIX_FADV_DONTNEED);
+
+    if (stats)
+        updateStats();
+}
+
+void ReadaheadPlanner::updateStats()
+{
+    QString read = QLatin1String("unknown");
+    qint64 bytesRead = storageBytesRead();
+    if (bytesRead >= 0 && initialBytesRead >= 0)
+        read = QString("%1 MB").arg((bytesRead - initialBytesRead) / (1024 * 1024));
+    Stats::instance()->setting("Read-ahead", QString("%1 MB advised, %2 read from storage")
+                               .arg(bytesAdvised / (1024 * 1024)).arg(read));
+}
+
+SvnPrivate::SvnPrivate(const QString &pathToRepository)
+    : global_pool(NULL) , scratch_pool(NULL), prefetcher(0), rootCache(0), dirCache(0), propCache(0), blobReader(0),
+      readahead(0), loader(0), changesIndex(0), walker(0), occupancy(0)
+{
+    configureFsCache();
+    // the prefetch threads open their own svn_fs_t
+    svn_error_clear(svn_fs_initialize(global_pool));
+
+    QString dumpFile = CommandLineParser::instance()->optionArgument(QLatin1String("dump"));
+    if (!dumpFile.isEmpty()) {
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 8
+        if (createRepository(pathToRepository, scratch_pool) != EXIT_SUCCESS) {
+            qCritical() << "Failed to create repository" << pathToRepository;
+            exit(1);
+        }
+#else
+        qCritical() << "Reading dumps needs Subversion 1.8 or later";
+        exit(1);
+#endif
+    }
+
+    if( openRepository(pathToRepository) != EXIT_SUCCESS) {
+        qCritical() << "Failed to open repository";
+        exit(1);
+    }
+
+    // get the youngest revision
+    svn_fs_youngest_rev(&youngest_rev, fs, global_pool);
+
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 8
+    if (!dumpFile.isEmpty()) {
+        loader = new DumpLoader(repositoryPath, dumpFile, youngest_rev);
+        loader->start();
+    }
+#endif
+
+    rootCache = new RevisionRootCache(fs, global_pool);
+
+    if (CommandLineParser::instance()->contains(QLatin1String("walk-threads"))) {
+        int threadCount = CommandLineParser::instance()->optionArgument(QLatin1String("walk-threads")).toInt();
+        bool dirProps = CommandLineParser::instance()->contains(QLatin1String("svn-ignore"))
+            || CommandLineParser::instance()->contains(QLatin1String("propcheck"));
+        if (threadCount > 0)
+            walker = new TreeWalker(repositoryPath, threadCount, dirProps);
+    }
+
+    int dirCacheSize = 64;
+    if (CommandLineParser::instance()->contains(QLatin1String("dir-cache-size")))
+        dirCacheSize = CommandLineParser::instance()->optionArgument(QLatin1String("dir-cache-size")).toInt();
+    dirCache = new DirEntriesCache(qBound(0, dirCacheSize, 2047) * 1024 * 1024, walker);
+    propCache = new NodePropsCache(walker);
+
+    if (CommandLineParser::instance()->contains(QLatin1String("empty-dirs")))
+        occupancy = new DirOccupancy;
+
+    if (CommandLineParser::instance()->contains(QLatin1String("reader-threads"))
+            && !CommandLineParser::instance()->contains(QLatin1String("dry-run"))) {
+        int threadCount = CommandLineParser::instance()->optionArgument(QLatin1String("reader-threads")).toInt();
+        if (threadCount > 0)
+            blobReader = new BlobReader(repositoryPath, threadCount);
+    }
+
+    if (CommandLineParser::instance()->contains(QLatin1String("readahead"))) {
+        int window = CommandLineParser::instance()->optionArgument(QLatin1String("readahead")).toInt();
+        if (window > 0)
+            readahead = new ReadaheadPlanner(repositoryPath, youngest_rev, window);
+    }
+
+    if (CommandLineParser::instance()->contains(QLatin1String("changes-index"))) {
+        const char *uuid = "";
+        svn_error_clear(svn_fs_get_uuid(fs, &uuid, scratch_pool));
+        changesIndex = new ChangesIndex(CommandLineParser::instance()->optionArgument(QLatin1String("changes-index")),
+                                        QByteArray(uuid));
+        updateChangesIndex();
+    }
+}
+
+bool SvnPrivate::waitForRevision(int revnum)
+{
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 8
+    if (loader && loader->waitForRevision(revnum))
+        youngest_rev = qMax<svn_revnum_t>(youngest_rev, revnum);
+#endif
+    return revnum <= youngest_rev;
+}
+
+bool SvnPrivate::inputFailed()
+{
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 8
+    return loader && loader->failed();
+#else
+    return false;
+#endif
+}
+
+SvnPrivate::~SvnPrivate()
 {
-    struct tm tm;
-    memset(&tm, 0, sizeof tm);
-    QByteArray date(svn_date, strlen(svn_date) - 8);
-    strptime(date, "%Y-%m-%dT%H:%M:%S", &tm);
-    return timegm(&tm);
+    delete changesIndex;
+#if SVN_VER_MAJOR > 1 || SVN_VER_MINOR >= 8
+    delete loader;
+#endif
+    delete prefetcher;
+    delete rootCache;
+    delete dirCache;
+    delete propCache;
+    delete blobReader;
+    delete readahead;
+    delete walker;
+    delete occupancy;
 }
 
 class SvnRevision
@@ -341,6 +3063,13 @@ public:
     svn_fs_t *fs;
     svn_fs_root_t *fs_root;
     int revnum;
+    RevisionInfo info;
+    RevisionRootCache *rootCache;
+    DirEntriesCache *dirCache;
+    NodePropsCache *propCache;
+    BlobReader *blobReader;
+    TreeWalker *walker;
+    DirOccupancy *occupancy;
 
     // must call fetchRevProps first:
     QByteArray authorident;
@@ -350,33 +3079,50 @@ public:
     bool propsFetched;
     bool needCommit;
 
-    SvnRevision(int revision, svn_fs_t *f, apr_pool_t *parent_pool)
-        : pool(parent_pool), fs(f), fs_root(0), revnum(revision), propsFetched(false)
+    // what splitPathName made of the prefix a rule matched
+    struct SplitPathName
+    {
+        QString repository;
+        QString effectiveRepository;
+        QString branch;
+        QString prefix;
+    };
+    QHash<QPair<const Rules::Match *, QString>, SplitPathName> splitPathNames;
+
+    SvnRevision(int revision, svn_fs_t *f, RevisionRootCache *roots, DirEntriesCache *dirs,
+                NodePropsCache *nodeProps, BlobReader *reader, TreeWalker *treeWalker, DirOccupancy *dirOccupancy,
+                apr_pool_t *parent_pool)
+        : pool(parent_pool), fs(f), fs_root(0), revnum(revision), rootCache(roots), dirCache(dirs),
+          propCache(nodeProps), blobReader(reader), walker(treeWalker), occupancy(dirOccupancy),
+          propsFetched(false)
     {
         ruledebug = CommandLineParser::instance()->contains( QLatin1String("debug-rules"));
     }
 
     int open()
     {
-        SVN_ERR(svn_fs_revision_root(&fs_root, fs, revnum, pool));
+        SVN_ERR(rootCache->revisionRoot(&fs_root, revnum));
         return EXIT_SUCCESS;
     }
 
     int prepareTransactions();
+    bool exportsFile(const QString &current);
     int fetchRevProps();
     int commit();
 
-    int exportEntry(const char *path, const svn_fs_path_change2_t *change, apr_hash_t *changes);
-    int exportDispatch(const char *path, const svn_fs_path_change2_t *change,
+    int exportEntry(const char *path, const PathChange *change, const PathChangeList &changes);
+    int exportDispatch(const char *path, const PathChange *change,
                        const char *path_from, svn_revnum_t rev_from,
-                       apr_hash_t *changes, const QString &current, const Rules::Match &rule,
+                       const PathChangeList &changes, const QString &current, const Rules::Match &rule,
                        const MatchRuleList &matchRules, apr_pool_t *pool);
-    int exportInternal(const char *path, const svn_fs_path_change2_t *change,
+    int exportInternal(const char *path, const PathChange *change,
                        const char *path_from, svn_revnum_t rev_from,
                        const QString &current, const Rules::Match &rule, const MatchRuleList &matchRules);
-    int recurse(const char *path, const svn_fs_path_change2_t *change,
+    bool exportPropertyChange(const char *key, const QString &current, const MatchRuleList &matchRules,
+                              apr_pool_t *pool);
+    int recurse(const char *path, const PathChange *change,
                 const char *path_from, const MatchRuleList &matchRules, svn_revnum_t rev_from,
-                apr_hash_t *changes, apr_pool_t *pool);
+                const PathChangeList &changes, apr_pool_t *pool);
     int addGitIgnore(apr_pool_t *pool, const char *key, QString path,
                      svn_fs_root_t *fs_root, Repository::Transaction *txn, const char *content = NULL);
     int checkParentNotEmpty(apr_pool_t *pool, const char *key, QString path,
@@ -384,21 +3130,62 @@ public:
     int addGitIgnoreOnBranch(apr_pool_t *pool, QString key, QString path,
                              svn_fs_root_t *fs_root, Repository::Transaction *txn);
     int fetchIgnoreProps(QString *ignore, apr_pool_t *pool, const char *key, svn_fs_root_t *fs_root);
+    bool ignorePropsChanged(apr_pool_t *pool, const char *key,
+                            svn_fs_root_t *previous_fs_root = NULL, const char *previous_key = NULL);
     int fetchUnknownProps(apr_pool_t *pool, const char *key, svn_fs_root_t *fs_root);
 private:
+    svn_error_t *dirEntryCount(int *count, svn_fs_root_t *fs_root, int root_revnum, const char *path,
+                               apr_pool_t *pool);
     int checkParentNoLongerEmpty(apr_pool_t *pool, const char *key, QString path, Repository::Transaction *txn);
     void splitPathName(const Rules::Match &rule, const QString &pathName, QString *svnprefix_p,
                        QString *repository_p, QString *effectiveRepository_p, QString *branch_p, QString *path_p);
+    void requestFiles(svn_fs_root_t *fs_root, const QByteArray &path, const DirEntryList &entries,
+                      const MatchRuleList *matchRules = NULL);
     int recursiveDumpDir(Repository::Transaction *txn, svn_fs_t *fs, svn_fs_root_t *fs_root,
                          const QByteArray &pathname, const QString &finalPathName,
                          apr_pool_t *pool, svn_revnum_t revnum,
                          const Rules::Match &rule, const MatchRuleList &matchRules,
                          bool ruledebug, int ignoreSet);
+    bool exportedTo(const MatchRuleList &matchRules, svn_revnum_t rev, const QString &pathName,
+                    const QString &repository, const QString &branch);
+    void updateCopiedGitIgnore(Repository::Transaction *txn, apr_pool_t *pool, const char *key,
+                               svn_fs_root_t *fs_root_from, const char *keyFrom,
+                               const QString &finalPathName, const DirEntryList &entries);
+    int dumpCopyDifferences(Repository::Transaction *txn, svn_fs_root_t *fs_root_from,
+                            const QByteArray &pathname, const QByteArray &pathnameFrom,
+                            const QString &finalPathName, apr_pool_t *pool, svn_revnum_t rev_from,
+                            const Rules::Match &rule, const QString &repositoryFrom, const QString &branchFrom,
+                            const MatchRuleList &matchRules, bool unchanged);
 };
 
 int SvnPrivate::exportRevision(int revnum)
 {
-    SvnRevision rev(revnum, fs, global_pool);
+    if (!touchesExportedPath(revnum)) {
+        // count the rule matches an export would have made
+        PathChangeList changes;
+        changesIndex->changes(revnum, &changes);
+        onlyIgnoredChanges(allMatchRules, revnum, changes, AnyRule);
+        exportedPathTouched.remove(revnum);
+        if (occupancy) {
+            occupancy->begin(revnum, changes);
+            occupancy->finish();
+        }
+
+        printf("Exporting revision %d ", revnum);
+        printf(" nothing to do\n");
+        fflush(stdout);
+        return EXIT_SUCCESS;
+    }
+    exportedPathTouched.remove(revnum);
+
+    rootCache->releaseUnused();
+    if (blobReader)
+        blobReader->discard();
+    if (walker)
+        walker->discard();
+    if (readahead)
+        readahead->advance(revnum);
+    SvnRevision rev(revnum, fs, rootCache, dirCache, propCache, blobReader, walker, occupancy, global_pool);
     rev.allMatchRules = allMatchRules;
     rev.repositories = repositories;
     rev.identities = identities;
@@ -411,8 +3198,24 @@ int SvnPrivate::exportRevision(int revnum)
     if (rev.open() == EXIT_FAILURE)
         return EXIT_FAILURE;
 
+    if (!prefetcher || !prefetcher->take(revnum, &rev.info)) {
+        rev.info.revnum = revnum;
+        if (!changesIndex || !changesIndex->changes(revnum, &rev.info.changes)) {
+            if (fetchChanges(&rev.info, fs, rev.fs_root, rev.pool) == EXIT_FAILURE)
+                return EXIT_FAILURE;
+        }
+    }
+    if (changesIndex) {
+        changesIndex->append(revnum, rev.info.changes);
+        changesIndex->flush();
+    }
+
+    if (occupancy)
+        occupancy->begin(revnum, rev.info.changes);
     if (rev.prepareTransactions() == EXIT_FAILURE)
         return EXIT_FAILURE;
+    if (occupancy)
+        occupancy->finish();
 
     if (!rev.needCommit) {
         printf(" nothing to do\n");
@@ -422,6 +3225,8 @@ int SvnPrivate::exportRevision(int revnum)
     if (rev.commit() == EXIT_FAILURE)
         return EXIT_FAILURE;
 
+    if (CommandLineParser::instance()->contains("transaction-memory"))
+        printf(" (peak of %lld KiB in buffered file records)", Repository::takePeakBufferedRecordBytes() / 1024);
     printf(" done\n");
     return EXIT_SUCCESS;
 }
@@ -430,108 +3235,68 @@ void SvnRevision::splitPathName(const Rules::Match &rule, const QString &pathNam
                                 QString *repository_p, QString *effectiveRepository_p, QString *branch_p, QString *path_p)
 {
     QString svnprefix = pathName;
-    svnprefix.truncate(rule.rx.matchedLength());
+    svnprefix.truncate(rule.rx.matchedLength(pathName));
 
     if (svnprefix_p) {
         *svnprefix_p = svnprefix;
     }
 
-    if (repository_p) {
-        *repository_p = svnprefix;
-#if QT_VERSION >= 0x060000
-        *repository_p = rule.rx.replaceIn(*repository_p, rule.repository);
-#else
-        repository_p->replace(rule.rx, rule.repository);
-#endif
+    // the paths below one prefix only differ in what follows it
+    QPair<const Rules::Match *, QString> key(&rule, svnprefix);
+    QHash<QPair<const Rules::Match *, QString>, SplitPathName>::ConstIterator split = splitPathNames.constFind(key);
+    if (split == splitPathNames.constEnd()) {
+        SplitPathName result;
+        result.repository = rule.rx.replaceIn(svnprefix, rule.repository);
         foreach (Rules::Match::Substitution subst, rule.repo_substs) {
-            subst.apply(*repository_p);
+            subst.apply(result.repository);
         }
-    }
 
-    if (effectiveRepository_p) {
-        *effectiveRepository_p = svnprefix;
-#if QT_VERSION >= 0x060000
-        *effectiveRepository_p = rule.rx.replaceIn(*effectiveRepository_p, rule.repository);
-#else
-        effectiveRepository_p->replace(rule.rx, rule.repository);
-#endif
-        foreach (Rules::Match::Substitution subst, rule.repo_substs) {
-            subst.apply(*effectiveRepository_p);
-        }
-        Repository *repository = repositories.value(*effectiveRepository_p, 0);
+        result.effectiveRepository = result.repository;
+        Repository *repository = repositories.value(result.effectiveRepository, 0);
         if (repository) {
-            *effectiveRepository_p = repository->getEffectiveRepository()->getName();
+            result.effectiveRepository = repository->getEffectiveRepository()->getName();
         }
-    }
 
-    if (branch_p) {
-        *branch_p = svnprefix;
-#if QT_VERSION >= 0x060000
-        *branch_p = rule.rx.replaceIn(*branch_p, rule.branch);
-#else
-        branch_p->replace(rule.rx, rule.branch);
-#endif
+        result.branch = rule.rx.replaceIn(svnprefix, rule.branch);
         foreach (Rules::Match::Substitution subst, rule.branch_substs) {
-            subst.apply(*branch_p);
+            subst.apply(result.branch);
         }
+
+        result.prefix = rule.rx.replaceIn(svnprefix, rule.prefix);
+        split = splitPathNames.insert(key, result);
+    }
+
+    if (repository_p) {
+        *repository_p = split->repository;
+    }
+
+    if (effectiveRepository_p) {
+        *effectiveRepository_p = split->effectiveRepository;
+    }
+
+    if (branch_p) {
+        *branch_p = split->branch;
     }
 
     if (path_p) {
-        QString prefix = svnprefix;
-#if QT_VERSION >= 0x060000
-        prefix = rule.rx.replaceIn(prefix, rule.prefix);
-#else
-        prefix.replace(rule.rx, rule.prefix);
-#endif
-        *path_p = prefix + pathName.mid(svnprefix.length());
+        *path_p = split->prefix + pathName.mid(svnprefix.length());
     }
 }
 
 int SvnRevision::prepareTransactions()
 {
-    // find out what was changed in this revision:
-    apr_hash_t *changes;
-    SVN_ERR(svn_fs_paths_changed2(&changes, fs_root, pool));
-
-#if QT_VERSION >= 0x060000
-    QMultiMap<QByteArray, svn_fs_path_change2_t*> map;
-#else
-    QMap<QByteArray, svn_fs_path_change2_t*> map;
-#endif
-    for (apr_hash_index_t *i = apr_hash_first(pool, changes); i; i = apr_hash_next(i)) {
-        const void *vkey;
-        void *value;
-        apr_hash_this(i, &vkey, NULL, &value);
-        const char *key = reinterpret_cast<const char *>(vkey);
-        svn_fs_path_change2_t *change = reinterpret_cast<svn_fs_path_change2_t *>(value);
-        // If we mix path deletions with path adds/replaces we might erase a
-        // branch after that it has been reset -> history truncated
-        if (map.contains(QByteArray(key))) {
-            // If the same path is deleted and added, we need to put the
-            // deletions into the map first, then the addition.
-            if (change->change_kind == svn_fs_path_change_delete) {
-                // XXX
-            }
-            fprintf(stderr, "\nDuplicate key found in rev %d: %s\n", revnum, key);
-            fprintf(stderr, "This needs more code to be handled, file a bug report\n");
-            fflush(stderr);
-            exit(1);
+    if (blobReader) {
+        foreach (const PathChange &change, info.changes) {
+            // exportPropertyChange does not need the contents of the others
+            if (!change.is_dir && change.change_kind != svn_fs_path_change_delete
+                    && (change.text_mod || change.change_kind != svn_fs_path_change_modify)
+                    && exportsFile(QString::fromUtf8(change.path)))
+                blobReader->request(revnum, change.path);
         }
-#if QT_VERSION >= 0x060000
-        map.insert(QByteArray(key), change);
-#else
-        map.insertMulti(QByteArray(key), change);
-#endif
     }
 
-#if QT_VERSION >= 0x060000
-    QMultiMapIterator<QByteArray, svn_fs_path_change2_t*> i(map);
-#else
-    QMapIterator<QByteArray, svn_fs_path_change2_t*> i(map);
-#endif
-    while (i.hasNext()) {
-        i.next();
-        if (exportEntry(i.key(), i.value(), changes) == EXIT_FAILURE)
+    foreach (const PathChange &change, info.changes) {
+        if (exportEntry(change.path.constData(), &change, info.changes) == EXIT_FAILURE)
             return EXIT_FAILURE;
     }
 
@@ -543,23 +3308,17 @@ int SvnRevision::fetchRevProps()
     if( propsFetched )
         return EXIT_SUCCESS;
 
-    apr_hash_t *revprops;
-    SVN_ERR(svn_fs_revision_proplist(&revprops, fs, revnum, pool));
-    svn_string_t *svnauthor = (svn_string_t*)apr_hash_get(revprops, "svn:author", APR_HASH_KEY_STRING);
-    svn_string_t *svndate = (svn_string_t*)apr_hash_get(revprops, "svn:date", APR_HASH_KEY_STRING);
-    svn_string_t *svnlog = (svn_string_t*)apr_hash_get(revprops, "svn:log", APR_HASH_KEY_STRING);
+    if (!info.revpropsFetched && fetchRevisionProps(&info, fs, pool) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
 
-    if (svnlog)
-        log = svnlog->data;
-    else
-        log.clear();
-    authorident = svnauthor ? identities.value(svnauthor->data) : QByteArray();
-    epoch = svndate ? get_epoch(svndate->data) : 0;
+    log = info.log;
+    authorident = !info.author.isNull() ? identities.value(info.author) : QByteArray();
+    epoch = !info.date.isNull() ? get_epoch(info.date.constData()) : 0;
     if (authorident.isEmpty()) {
-        if (!svnauthor || svn_string_isempty(svnauthor))
+        if (info.author.isEmpty())
             authorident = "nobody <nobody@localhost>";
         else
-            authorident = svnauthor->data + QByteArray(" <") + svnauthor->data +
+            authorident = info.author + QByteArray(" <") + info.author +
                 QByteArray("@") + userdomain.toUtf8() + QByteArray(">");
     }
     propsFetched = true;
@@ -588,24 +3347,29 @@ int SvnRevision::commit()
     return EXIT_SUCCESS;
 }
 
-int SvnRevision::exportEntry(const char *key, const svn_fs_path_change2_t *change,
-                             apr_hash_t *changes)
+// whether a rule exports the file current of this revision to some repository
+bool SvnRevision::exportsFile(const QString &current)
+{
+    foreach (const MatchRuleList &matchRules, allMatchRules) {
+        MatchRuleList::ConstIterator match = findMatchRule(matchRules, revnum, current, NoStats);
+        if (match != matchRules.constEnd() && match->action == Rules::Match::Export)
+            return true;
+    }
+    return false;
+}
+
+int SvnRevision::exportEntry(const char *key, const PathChange *change,
+                             const PathChangeList &changes)
 {
     AprAutoPool revpool(pool.data());
     QString current = QString::fromUtf8(key);
 
     // was this copied from somewhere?
-    svn_revnum_t rev_from = SVN_INVALID_REVNUM;
-    const char *path_from = NULL;
-    if (change->change_kind != svn_fs_path_change_delete) {
-        // svn_fs_copied_from would fail on deleted paths, because the path
-        // obviously no longer exists in the current revision
-        SVN_ERR(svn_fs_copied_from(&rev_from, &path_from, fs_root, key, revpool));
-    }
+    svn_revnum_t rev_from = change->copyfrom_rev;
+    const char *path_from = change->copyfrom_path.isNull() ? NULL : change->copyfrom_path.constData();
 
     // is this a directory?
-    svn_boolean_t is_dir;
-    SVN_ERR(svn_fs_is_dir(&is_dir, fs_root, key, revpool));
+    bool is_dir = change->is_dir;
     // Adding newly created directories
     if (is_dir && change->change_kind == svn_fs_path_change_add && path_from == NULL
         && CommandLineParser::instance()->contains("empty-dirs")) {
@@ -648,7 +3412,7 @@ int SvnRevision::exportEntry(const char *key, const svn_fs_path_change2_t *chang
             return EXIT_FAILURE;
         }
     } else if (change->change_kind == svn_fs_path_change_delete) {
-        is_dir = wasDir(fs, revnum - 1, key, revpool);
+        is_dir = change->was_dir;
     }
 
     if (is_dir)
@@ -680,7 +3444,7 @@ int SvnRevision::exportEntry(const char *key, const svn_fs_path_change2_t *chang
     if ( isHandled ) {
         return EXIT_SUCCESS;
     }
-    if (wasDir(fs, revnum - 1, key, revpool)) {
+    if (rootCache->isDir(revnum - 1, key, revpool)) {
         qDebug() << current << "was a directory; ignoring";
     } else if (change->change_kind == svn_fs_path_change_delete) {
         qDebug() << current << "is being deleted but I don't know anything about it; ignoring";
@@ -691,9 +3455,9 @@ int SvnRevision::exportEntry(const char *key, const svn_fs_path_change2_t *chang
     return EXIT_SUCCESS;
 }
 
-int SvnRevision::exportDispatch(const char *key, const svn_fs_path_change2_t *change,
+int SvnRevision::exportDispatch(const char *key, const PathChange *change,
                                 const char *path_from, svn_revnum_t rev_from,
-                                apr_hash_t *changes, const QString &current,
+                                const PathChangeList &changes, const QString &current,
                                 const Rules::Match &rule, const MatchRuleList &matchRules, apr_pool_t *pool)
 {
     //if(ruledebug)
@@ -729,7 +3493,7 @@ int SvnRevision::exportDispatch(const char *key, const svn_fs_path_change2_t *ch
     return EXIT_FAILURE;
 }
 
-int SvnRevision::exportInternal(const char *key, const svn_fs_path_change2_t *change,
+int SvnRevision::exportInternal(const char *key, const PathChange *change,
                                 const char *path_from, svn_revnum_t rev_from,
                                 const QString &current, const Rules::Match &rule, const MatchRuleList &matchRules)
 {
@@ -762,7 +3526,7 @@ int SvnRevision::exportInternal(const char *key, const svn_fs_path_change2_t *ch
     bool needRecursiveDump = false;
     if (path_from != NULL) {
         previous = QString::fromUtf8(path_from);
-        if (wasDir(fs, rev_from, path_from, pool.data())) {
+        if (rootCache->isDir(rev_from, path_from, pool.data())) {
             previous += '/';
         }
         MatchRuleList::ConstIterator prevmatch =
@@ -796,8 +3560,7 @@ int SvnRevision::exportInternal(const char *key, const svn_fs_path_change2_t *ch
             qDebug() << qPrintable(current)
                      << "is a branch copy which renames base directory of all contents"
                      << qPrintable(prevpath) << "to" << qPrintable(path);
-            // FIXME: Handle with fast-import 'file rename' facility
-            //        ??? Might need special handling when path == / or prevpath == /
+            // the tree of prevpath becomes the root of the branch below
         } else {
             if (prevbranch == branch) {
                 // same branch and same repository
@@ -828,7 +3591,9 @@ int SvnRevision::exportInternal(const char *key, const svn_fs_path_change2_t *ch
 
                 AprAutoPool pool_from(pool.data());
                 svn_fs_root_t *fs_root_from;
-                if (svn_fs_revision_root(&fs_root_from, fs, rev_from, pool_from) != SVN_NO_ERROR) {
+                svn_error_t *err = rootCache->revisionRoot(&fs_root_from, rev_from);
+                if (err != SVN_NO_ERROR) {
+                    svn_error_clear(err);
                     return EXIT_FAILURE;
                 }
 
@@ -848,9 +3613,25 @@ int SvnRevision::exportInternal(const char *key, const svn_fs_path_change2_t *ch
                 }
                 if(ruledebug)
                     qDebug() << "Create a true SVN copy of branch (" << key << "->" << branch << path << ")";
-                txn->deleteFile(path);
-                checkParentNotEmpty(pool, key, path, fs_root, txn);
-                recursiveDumpDir(txn, fs, fs_root, key, path, pool, revnum, rule, matchRules, ruledebug, false);
+                // the branch starts out with the tree of the copy source,
+                // only what differs from it has to be dumped
+                svn_fs_root_t *fs_root_from = NULL;
+                if (repo->hasCommit(prevbranch, rev_from)) {
+                    svn_error_t *err = rootCache->revisionRoot(&fs_root_from, rev_from);
+                    if (err != SVN_NO_ERROR) {
+                        svn_error_clear(err);
+                        fs_root_from = NULL;
+                    }
+                }
+                if (fs_root_from) {
+                    if (dumpCopyDifferences(txn, fs_root_from, key, path_from, path, pool, rev_from, rule,
+                                            prevrepository, prevbranch, matchRules, false) == EXIT_FAILURE)
+                        return EXIT_FAILURE;
+                } else {
+                    txn->deleteFile(path);
+                    checkParentNotEmpty(pool, key, path, fs_root, txn);
+                    recursiveDumpDir(txn, fs, fs_root, key, path, pool, revnum, rule, matchRules, ruledebug, false);
+                }
                 if (CommandLineParser::instance()->contains("empty-dirs")) {
                     addGitIgnoreOnBranch(pool, key, path, fs_root, txn);
                 }
@@ -899,7 +3680,9 @@ int SvnRevision::exportInternal(const char *key, const svn_fs_path_change2_t *ch
     } else if (!current.endsWith('/')) {
         if(ruledebug)
             qDebug() << "add/change file (" << key << "->" << branch << path << ")";
-        dumpBlob(txn, fs_root, key, path, pool);
+        if (change->change_kind != svn_fs_path_change_modify || change->text_mod || path_from != NULL
+                || !exportPropertyChange(key, current, matchRules, pool))
+            dumpBlob(txn, fs_root, propCache, blobReader, key, path, pool);
         checkParentNoLongerEmpty(pool, key, path, txn);
     } else {
         if(ruledebug)
@@ -937,14 +3720,20 @@ int SvnRevision::exportInternal(const char *key, const svn_fs_path_change2_t *ch
         if (((path_from == NULL && change->prop_mod==1) || (path_from != NULL && (change->change_kind == svn_fs_path_change_add || change->change_kind == svn_fs_path_change_replace)))
             && CommandLineParser::instance()->contains("svn-ignore")) {
             QString svnignore;
-            // TODO: Check if svn:ignore or other property was changed, but always set on copy/rename (path_from != NULL)
+            // always set on copy/rename (path_from != NULL), otherwise only
+            // if it was another property that changed, the .gitignore is there already
+            bool ignoreChanged = path_from != NULL || change->change_kind != svn_fs_path_change_modify
+                || ignorePropsChanged(pool, key);
             if (fetchIgnoreProps(&svnignore, pool, key, fs_root) != EXIT_SUCCESS) {
                 qWarning() << "Error fetching svn-properties (" << key << ")";
             } else if (svnignore.isNull()) {
-                QString gitIgnorePath = path == "/" ? ".gitignore" : path + ".gitignore";
-                txn->deleteFile(gitIgnorePath);
+                if (ignoreChanged) {
+                    QString gitIgnorePath = path == "/" ? ".gitignore" : path + ".gitignore";
+                    txn->deleteFile(gitIgnorePath);
+                }
             } else {
-                addGitIgnore(pool, key, path, fs_root, txn, svnignore.toStdString().c_str());
+                if (ignoreChanged)
+                    addGitIgnore(pool, key, path, fs_root, txn, svnignore.toStdString().c_str());
                 ignoreSet = true;
             }
         }
@@ -957,7 +3746,26 @@ int SvnRevision::exportInternal(const char *key, const svn_fs_path_change2_t *ch
         }
 
         if (dumpDirectory) {
-            recursiveDumpDir(txn, fs, fs_root, key, path, pool, revnum, rule, matchRules, ruledebug, ignoreSet);
+            // a copy within the repository takes the tree fast-import
+            // already has for the source, with a C command inside the
+            // branch, and dumps what differs from it
+            svn_fs_root_t *fs_root_from = NULL;
+            if (path_from != NULL && prevrepository == repository) {
+                svn_error_t *err = rootCache->revisionRoot(&fs_root_from, rev_from);
+                if (err != SVN_NO_ERROR) {
+                    svn_error_clear(err);
+                    fs_root_from = NULL;
+                }
+            }
+            if (fs_root_from && txn->copyTree(path, prevbranch, rev_from, prevpath)) {
+                if(ruledebug)
+                    qDebug() << "copy tree of (" << prevbranch << prevpath << "->" << branch << path << ")";
+                if (dumpCopyDifferences(txn, fs_root_from, key, path_from, path, pool, rev_from, rule,
+                                        prevrepository, prevbranch, matchRules, false) == EXIT_FAILURE)
+                    return EXIT_FAILURE;
+            } else {
+                recursiveDumpDir(txn, fs, fs_root, key, path, pool, revnum, rule, matchRules, ruledebug, ignoreSet);
+            }
 
             if (CommandLineParser::instance()->contains("empty-dirs")) {
                 addGitIgnoreOnBranch(pool, key, path, fs_root, txn);
@@ -975,18 +3783,50 @@ int SvnRevision::exportInternal(const char *key, const svn_fs_path_change2_t *ch
     return EXIT_SUCCESS;
 }
 
+// with matchRules, only the files they export are requested
+void SvnRevision::requestFiles(svn_fs_root_t *fs_root, const QByteArray &path, const DirEntryList &entries,
+                               const MatchRuleList *matchRules)
+{
+    if (!blobReader)
+        return;
+
+    int revision = svn_fs_revision_root_revision(fs_root);
+
+    // queue the reads in storage order, the finished buffers wait until
+    // dumpBlob gets to them in name order
+    DirEntryList files;
+    foreach (const DirEntry &dirent, entries) {
+        if (dirent.kind != svn_node_file)
+            continue;
+        if (matchRules) {
+            QString current = QString::fromUtf8(path + '/' + dirent.name);
+            MatchRuleList::ConstIterator match = findMatchRule(*matchRules, revision, current, NoStats);
+            if (match == matchRules->constEnd() || match->action != Rules::Match::Export)
+                continue;
+        }
+        files.append(dirent);
+    }
+    std::sort(files.begin(), files.end(), dirEntryReadOrderLessThan);
+
+    foreach (const DirEntry &dirent, files)
+        blobReader->request(revision, path + '/' + dirent.name);
+}
+
 int SvnRevision::recursiveDumpDir(Repository::Transaction *txn, svn_fs_t *fs, svn_fs_root_t *fs_root,
                                   const QByteArray &pathname, const QString &finalPathName,
                                   apr_pool_t *pool, svn_revnum_t revnum,
                                   const Rules::Match &rule, const MatchRuleList &matchRules,
                                   bool ruledebug, int ignoreSet)
 {
-    if (!wasDir(fs, revnum, pathname.data(), pool)) {
-        if (dumpBlob(txn, fs_root, pathname, finalPathName, pool) == EXIT_FAILURE)
+    if (!rootCache->isDir(revnum, pathname.data(), pool)) {
+        if (dumpBlob(txn, fs_root, propCache, blobReader, pathname, finalPathName, pool) == EXIT_FAILURE)
             return EXIT_FAILURE;
         return EXIT_SUCCESS;
     }
 
+    if (walker)
+        walker->walk(revnum, pathname, TreeWalker::ExportTree, matchRules, rule.repository);
+
     if ((ignoreSet == false) && CommandLineParser::instance()->contains("svn-ignore")) {
         QString svnignore;
         if (fetchIgnoreProps(&svnignore, pool, pathname, fs_root) != EXIT_SUCCESS) {
@@ -997,41 +3837,20 @@ int SvnRevision::recursiveDumpDir(Repository::Transaction *txn, svn_fs_t *fs, sv
     }
 
     // get the dir listing
-    apr_hash_t *entries;
-    SVN_ERR(svn_fs_dir_entries(&entries, fs_root, pathname, pool));
+    DirEntryList entries;
+    SVN_ERR(dirCache->entries(&entries, fs_root, pathname, pool));
     AprAutoPool dirpool(pool);
 
-    // While we get a hash, put it in a map for sorted lookup, so we can
-    // repeat the conversions and get the same git commit hashes.
-#if QT_VERSION >= 0x060000
-    QMultiMap<QByteArray, svn_node_kind_t> map;
-#else
-    QMap<QByteArray, svn_node_kind_t> map;
-#endif
-    for (apr_hash_index_t *i = apr_hash_first(pool, entries); i; i = apr_hash_next(i)) {
-        const void *vkey;
-        void *value;
-        apr_hash_this(i, &vkey, NULL, &value);
-        svn_fs_dirent_t *dirent = reinterpret_cast<svn_fs_dirent_t *>(value);
-#if QT_VERSION >= 0x060000
-        map.insert(QByteArray(dirent->name), dirent->kind);
-#else
-        map.insertMulti(QByteArray(dirent->name), dirent->kind);
-#endif
-    }
+    // let the readers start on the files while we descend into the
+    // subdirectories; all of them are dumped, whatever rule they match
+    requestFiles(fs_root, pathname, entries);
 
-#if QT_VERSION >= 0x060000
-    QMultiMapIterator<QByteArray, svn_node_kind_t> i(map);
-#else
-    QMapIterator<QByteArray, svn_node_kind_t> i(map);
-#endif
-    while (i.hasNext()) {
+    foreach (const DirEntry &dirent, entries) {
         dirpool.clear();
-        i.next();
-        QByteArray entryName = pathname + '/' + i.key();
-        QString entryFinalName = finalPathName + QString::fromUtf8(i.key());
+        QByteArray entryName = pathname + '/' + dirent.name;
+        QString entryFinalName = finalPathName + QString::fromUtf8(dirent.name);
 
-        if (i.value() == svn_node_dir) {
+        if (dirent.kind == svn_node_dir) {
             entryFinalName += '/';
             QString entryNameQString = entryName + '/';
 
@@ -1047,28 +3866,203 @@ int SvnRevision::recursiveDumpDir(Repository::Transaction *txn, svn_fs_t *fs, sv
 
             if (recursiveDumpDir(txn, fs, fs_root, entryName, entryFinalName, dirpool, revnum, rule, matchRules, ruledebug, false) == EXIT_FAILURE)
                 return EXIT_FAILURE;
-        } else if (i.value() == svn_node_file) {
+        } else if (dirent.kind == svn_node_file) {
+            printf("+");
+            fflush(stdout);
+            if (dumpBlob(txn, fs_root, propCache, blobReader, entryName, entryFinalName, dirpool) == EXIT_FAILURE)
+                return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// whether the directory pathName was exported to branch of repository in
+// revision rev, that is whether the tree of the branch has it
+bool SvnRevision::exportedTo(const MatchRuleList &matchRules, svn_revnum_t rev, const QString &pathName,
+                             const QString &repository, const QString &branch)
+{
+    MatchRuleList::ConstIterator match = findMatchRule(matchRules, rev, pathName, NoStats);
+    if (match == matchRules.constEnd() || match->action != Rules::Match::Export)
+        return false;
+
+    QString matchRepository, matchBranch;
+    splitPathName(*match, pathName, NULL, &matchRepository, NULL, &matchBranch, NULL);
+    return matchRepository == repository && matchBranch == branch;
+}
+
+// the copied tree has the .gitignore of the copy source, written from
+// its svn:ignore or as a placeholder for an empty directory
+void SvnRevision::updateCopiedGitIgnore(Repository::Transaction *txn, apr_pool_t *pool, const char *key,
+                                        svn_fs_root_t *fs_root_from, const char *keyFrom,
+                                        const QString &finalPathName, const DirEntryList &entries)
+{
+    bool svnIgnore = CommandLineParser::instance()->contains("svn-ignore");
+    if (!svnIgnore && !CommandLineParser::instance()->contains("empty-dirs"))
+        return;
+
+    // a .gitignore of the SVN tree is compared like any other file
+    foreach (const DirEntry &dirent, entries) {
+        if (dirent.name == ".gitignore")
+            return;
+    }
+
+    QString svnignore;
+    if (svnIgnore) {
+        if (fetchIgnoreProps(&svnignore, pool, key, fs_root) != EXIT_SUCCESS) {
+            qWarning() << "Error fetching svn-properties (" << key << ")";
+            return;
+        }
+    }
+    if (!svnignore.isNull()) {
+        if (ignorePropsChanged(pool, key, fs_root_from, keyFrom))
+            addGitIgnore(pool, key, finalPathName, fs_root, txn, svnignore.toStdString().c_str());
+    } else {
+        // addGitIgnoreOnBranch brings the placeholder back if still empty
+        QString gitIgnorePath = finalPathName == "/" ? ".gitignore" : finalPathName + ".gitignore";
+        txn->deleteFile(gitIgnorePath);
+    }
+}
+
+// brings finalPathName, which holds the tree of pathnameFrom@rev_from as
+// exported to branchFrom, to the state of pathname: only entries with a
+// node-revision other than in the copy source are dumped, and the
+// directories and files the rules treat differently on the two sides.
+// unchanged is set for directories with the node-revision of the copy
+// source.
+int SvnRevision::dumpCopyDifferences(Repository::Transaction *txn, svn_fs_root_t *fs_root_from,
+                                     const QByteArray &pathname, const QByteArray &pathnameFrom,
+                                     const QString &finalPathName, apr_pool_t *pool, svn_revnum_t rev_from,
+                                     const Rules::Match &rule, const QString &repositoryFrom, const QString &branchFrom,
+                                     const MatchRuleList &matchRules, bool unchanged)
+{
+    DirEntryList entries, entriesFrom;
+    SVN_ERR(dirCache->entries(&entries, fs_root, pathname, pool));
+    if (unchanged) {
+        entriesFrom = entries;
+    } else {
+        SVN_ERR(dirCache->entries(&entriesFrom, fs_root_from, pathnameFrom, pool));
+        updateCopiedGitIgnore(txn, pool, pathname, fs_root_from, pathnameFrom, finalPathName, entries);
+    }
+    AprAutoPool dirpool(pool);
+
+    // both listings are sorted by name
+    DirEntryList::ConstIterator from = entriesFrom.constBegin();
+    foreach (const DirEntry &dirent, entries) {
+        dirpool.clear();
+        for ( ; from != entriesFrom.constEnd() && from->name < dirent.name; ++from)
+            txn->deleteFile(finalPathName + QString::fromUtf8(from->name));
+        const DirEntry *source = NULL;
+        if (from != entriesFrom.constEnd() && from->name == dirent.name)
+            source = &*from++;
+
+        QByteArray entryName = pathname + '/' + dirent.name;
+        QByteArray entryNameFrom = pathnameFrom + '/' + dirent.name;
+        QString entryFinalName = finalPathName + QString::fromUtf8(dirent.name);
+
+        if (dirent.kind == svn_node_dir) {
+            entryFinalName += '/';
+            QString entryNameQString = entryName + '/';
+
+            // the same choices as recursiveDumpDir
+            MatchRuleList::ConstIterator match = findMatchRule(matchRules, revnum, entryNameQString);
+            if (match == matchRules.constEnd()) continue; // no match of parent repo? (should not happen)
+
+            const Rules::Match &matchedRule = *match;
+            if (matchedRule.action != Rules::Match::Export || matchedRule.repository != rule.repository) {
+                if (ruledebug)
+                    qDebug() << "dumpCopyDifferences:" << entryNameQString << "skip entry for different/ignored repository";
+                if (source)
+                    txn->deleteFile(entryFinalName);
+                continue;
+            }
+
+            int result;
+            if (source && source->kind == svn_node_dir
+                    && exportedTo(matchRules, rev_from, entryNameFrom + '/', repositoryFrom, branchFrom)) {
+                // the copied tree has an unchanged subtree already, unless
+                // a rule sends some of it elsewhere on either side
+                if (source->id == dirent.id
+                        && ruleDecidesBelow(matchRules, revnum, entryNameQString)
+                        && ruleDecidesBelow(matchRules, rev_from, QString::fromUtf8(entryNameFrom + '/')))
+                    continue;
+                result = dumpCopyDifferences(txn, fs_root_from, entryName, entryNameFrom, entryFinalName, dirpool,
+                                             rev_from, rule, repositoryFrom, branchFrom, matchRules,
+                                             source->id == dirent.id);
+            } else {
+                // the copy source does not have it in its tree
+                if (source)
+                    txn->deleteFile(entryFinalName);
+                result = recursiveDumpDir(txn, fs, fs_root, entryName, entryFinalName, dirpool, revnum, rule,
+                                          matchRules, ruledebug, false);
+            }
+            if (result == EXIT_FAILURE)
+                return EXIT_FAILURE;
+        } else if (dirent.kind == svn_node_file) {
+            // the tree of the copy source lacks the files the rules left out
+            // of it or sent elsewhere in rev_from, whatever their node-revision
+            if (source && source->kind == svn_node_file && source->id == dirent.id
+                    && exportedTo(matchRules, rev_from, QString::fromUtf8(entryNameFrom), repositoryFrom, branchFrom))
+                continue;
             printf("+");
             fflush(stdout);
-            if (dumpBlob(txn, fs_root, entryName, entryFinalName, dirpool) == EXIT_FAILURE)
+            if (dumpBlob(txn, fs_root, propCache, blobReader, entryName, entryFinalName, dirpool) == EXIT_FAILURE)
                 return EXIT_FAILURE;
         }
     }
+    for ( ; from != entriesFrom.constEnd(); ++from)
+        txn->deleteFile(finalPathName + QString::fromUtf8(from->name));
 
     return EXIT_SUCCESS;
 }
 
-int SvnRevision::recurse(const char *path, const svn_fs_path_change2_t *change,
+// exports a change of a file that left its contents alone, the blob stays
+// in the tree. Returns false if the change must be exported with dumpBlob,
+// because the file was not exported to the same place in the previous
+// revision, its mode or the translation of its contents changed or it is,
+// or was, a symlink.
+bool SvnRevision::exportPropertyChange(const char *key, const QString &current,
+                                       const MatchRuleList &matchRules, apr_pool_t *pool)
+{
+    if (findMatchRule(matchRules, revnum, current, NoStats)
+            != findMatchRule(matchRules, revnum - 1, current, NoStats))
+        return false;
+
+    svn_fs_root_t *previous_fs_root;
+    svn_error_t *err = rootCache->revisionRoot(&previous_fs_root, revnum - 1);
+    NodeProps props, previous;
+    if (!err)
+        err = propCache->props(&props, fs_root, key, pool);
+    if (!err)
+        err = propCache->props(&previous, previous_fs_root, key, pool);
+    if (err) {
+        svn_error_clear(err);
+        return false;
+    }
+    if (props.contains("svn:special") || previous.contains("svn:special"))
+        return false;
+    // the translation of the contents changed
+    if (contentTransform(props) != contentTransform(previous))
+        return false;
+
+    // if the mode changed, dumpBlob adds the file again with its blob reused
+    return pathMode(props) == pathMode(previous);
+}
+
+int SvnRevision::recurse(const char *path, const PathChange *change,
                          const char *path_from, const MatchRuleList &matchRules, svn_revnum_t rev_from,
-                         apr_hash_t *changes, apr_pool_t *pool)
+                         const PathChangeList &changes, apr_pool_t *pool)
 {
     svn_fs_root_t *fs_root = this->fs_root;
-    if (change->change_kind == svn_fs_path_change_delete)
-        SVN_ERR(svn_fs_revision_root(&fs_root, fs, revnum - 1, pool));
+    int root_revnum = revnum;
+    if (change->change_kind == svn_fs_path_change_delete) {
+        root_revnum = revnum - 1;
+        SVN_ERR(rootCache->revisionRoot(&fs_root, root_revnum));
+    }
 
     // get the dir listing
     svn_node_kind_t kind;
-    SVN_ERR(svn_fs_check_path(&kind, fs_root, path, pool));
+    SVN_ERR(rootCache->checkPath(&kind, root_revnum, path, pool));
     if(kind == svn_node_none) {
         qWarning() << "WARN: Trying to recurse using a nonexistant path" << path << ", ignoring";
         return EXIT_SUCCESS;
@@ -1077,46 +4071,25 @@ int SvnRevision::recurse(const char *path, const svn_fs_path_change2_t *change,
         return EXIT_SUCCESS;
     }
 
-    apr_hash_t *entries;
-    SVN_ERR(svn_fs_dir_entries(&entries, fs_root, path, pool));
+    if (walker && change->change_kind != svn_fs_path_change_delete)
+        walker->walk(root_revnum, path, TreeWalker::DispatchTree, matchRules);
+
+    DirEntryList entries;
+    SVN_ERR(dirCache->entries(&entries, fs_root, path, pool));
     AprAutoPool dirpool(pool);
 
-    // While we get a hash, put it in a map for sorted lookup, so we can
-    // repeat the conversions and get the same git commit hashes.
-#if QT_VERSION >= 0x060000
-    QMultiMap<QByteArray, svn_node_kind_t> map;
-#else
-    QMap<QByteArray, svn_node_kind_t> map;
-#endif
-    for (apr_hash_index_t *i = apr_hash_first(pool, entries); i; i = apr_hash_next(i)) {
-        dirpool.clear();
-        const void *vkey;
-        void *value;
-        apr_hash_this(i, &vkey, NULL, &value);
-        svn_fs_dirent_t *dirent = reinterpret_cast<svn_fs_dirent_t *>(value);
-#if QT_VERSION >= 0x060000
-        map.insert(QByteArray(dirent->name), dirent->kind);
-#else
-        map.insertMulti(QByteArray(dirent->name), dirent->kind);
-#endif
-    }
+    if (change->change_kind != svn_fs_path_change_delete)
+        requestFiles(fs_root, path, entries, &matchRules);
 
-#if QT_VERSION >= 0x060000
-    QMultiMapIterator<QByteArray, svn_node_kind_t> i(map);
-#else
-    QMapIterator<QByteArray, svn_node_kind_t> i(map);
-#endif
-    while (i.hasNext()) {
+    foreach (const DirEntry &dirent, entries) {
         dirpool.clear();
-        i.next();
-        QByteArray entry = path + QByteArray("/") + i.key();
+        QByteArray entry = path + QByteArray("/") + dirent.name;
         QByteArray entryFrom;
         if (path_from)
-            entryFrom = path_from + QByteArray("/") + i.key();
+            entryFrom = path_from + QByteArray("/") + dirent.name;
 
         // check if this entry is in the changelist for this revision already
-        svn_fs_path_change2_t *otherchange =
-            (svn_fs_path_change2_t*)apr_hash_get(changes, entry.constData(), APR_HASH_KEY_STRING);
+        const PathChange *otherchange = findChange(changes, entry);
         if (otherchange && otherchange->change_kind == svn_fs_path_change_add) {
             qDebug() << entry << "rev" << revnum
                      << "is in the change-list, deferring to that one";
@@ -1124,7 +4097,7 @@ int SvnRevision::recurse(const char *path, const svn_fs_path_change2_t *change,
         }
 
         QString current = QString::fromUtf8(entry);
-        if (i.value() == svn_node_dir)
+        if (dirent.kind == svn_node_dir)
             current += '/';
 
         // find the first rule that matches this pathname
@@ -1134,7 +4107,7 @@ int SvnRevision::recurse(const char *path, const svn_fs_path_change2_t *change,
                                rev_from, changes, current, *match, matchRules, dirpool) == EXIT_FAILURE)
                 return EXIT_FAILURE;
         } else {
-            if (i.value() == svn_node_dir) {
+            if (dirent.kind == svn_node_dir) {
                 qDebug() << current << "rev" << revnum
                          << "did not match any rules; auto-recursing";
                 if (recurse(entry, change, entryFrom.isNull() ? 0 : entryFrom.constData(),
@@ -1147,15 +4120,29 @@ int SvnRevision::recurse(const char *path, const svn_fs_path_change2_t *change,
     return EXIT_SUCCESS;
 }
 
+// the few distinct .gitignore contents are sent to fast-import only once
+static void writeGitIgnore(Repository::Transaction *txn, const QString &gitIgnorePath, const QByteArray &content)
+{
+    QByteArray contentKey = QCryptographicHash::hash(content, QCryptographicHash::Sha1);
+    if (txn->reuseFile(gitIgnorePath, 33188, contentKey))
+        return;
+
+    QIODevice *io = txn->addFile(gitIgnorePath, 33188, content.size(), contentKey);
+    if (!CommandLineParser::instance()->contains("dry-run")) {
+        io->write(content);
+        io->putChar('\n');
+    }
+}
+
 int SvnRevision::addGitIgnore(apr_pool_t *pool, const char *key, QString path,
                               svn_fs_root_t *fs_root, Repository::Transaction *txn, const char *content)
 {
     // Check for number of subfiles if no content
     if (!content) {
-        apr_hash_t *entries;
-        SVN_ERR(svn_fs_dir_entries(&entries, fs_root, key, pool));
+        int count;
+        SVN_ERR(dirEntryCount(&count, fs_root, svn_fs_revision_root_revision(fs_root), key, pool));
         // Return if any subfiles
-        if (apr_hash_count(entries)!=0) {
+        if (count > 0) {
             return EXIT_FAILURE;
         }
 
@@ -1176,11 +4163,7 @@ int SvnRevision::addGitIgnore(apr_pool_t *pool, const char *key, QString path,
     // Add gitignore-File
     QString gitIgnorePath = path == "/" ? ".gitignore" : path + ".gitignore";
     if (content) {
-        QIODevice *io = txn->addFile(gitIgnorePath, 33188, strlen(content));
-        if (!CommandLineParser::instance()->contains("dry-run")) {
-            io->write(content);
-            io->putChar('\n');
-        }
+        writeGitIgnore(txn, gitIgnorePath, content);
     } else {
         // no empty placeholder .gitignore for repository root
         // this should be handled previously already, just a
@@ -1188,15 +4171,30 @@ int SvnRevision::addGitIgnore(apr_pool_t *pool, const char *key, QString path,
         if (path == "/") {
             return EXIT_FAILURE;
         }
-        QIODevice *io = txn->addFile(gitIgnorePath, 33188, 0);
-        if (!CommandLineParser::instance()->contains("dry-run")) {
-            io->putChar('\n');
-        }
+        writeGitIgnore(txn, gitIgnorePath, QByteArray());
     }
 
     return EXIT_SUCCESS;
 }
 
+// the number of entries of a directory, from the occupancy model if it
+// knows the directory, otherwise from a listing; fs_root is opened if null
+svn_error_t *SvnRevision::dirEntryCount(int *count, svn_fs_root_t *fs_root, int root_revnum, const char *path,
+                                        apr_pool_t *pool)
+{
+    if (occupancy && occupancy->entryCount(root_revnum, path, count))
+        return SVN_NO_ERROR;
+
+    if (!fs_root)
+        SVN_PROPAGATE_ERR(rootCache->revisionRoot(&fs_root, root_revnum));
+    DirEntryList entries;
+    SVN_PROPAGATE_ERR(dirCache->entries(&entries, fs_root, path, pool));
+    *count = entries.size();
+    if (occupancy)
+        occupancy->setEntryCount(root_revnum, path, *count);
+    return SVN_NO_ERROR;
+}
+
 int SvnRevision::checkParentNotEmpty(apr_pool_t *pool, const char *key, QString path,
                                      svn_fs_root_t *fs_root, Repository::Transaction *txn)
 {
@@ -1213,10 +4211,11 @@ int SvnRevision::checkParentNotEmpty(apr_pool_t *pool, const char *key, QString
     }
     QString parentKey = qkey.left(index);
 
-    apr_hash_t *entries;
-    SVN_ERR(svn_fs_dir_entries(&entries, fs_root, parentKey.toStdString().c_str(), pool));
+    int count;
+    SVN_ERR(dirEntryCount(&count, fs_root, svn_fs_revision_root_revision(fs_root),
+                          parentKey.toStdString().c_str(), pool));
     // directory is not empty
-    if (apr_hash_count(entries)!=0) {
+    if (count > 0) {
         return EXIT_FAILURE;
     }
 
@@ -1246,10 +4245,7 @@ int SvnRevision::checkParentNotEmpty(apr_pool_t *pool, const char *key, QString
 
     // Add gitignore-File
     QString gitIgnorePath = parentPath + "/.gitignore";
-    QIODevice *io = txn->addFile(gitIgnorePath, 33188, 0);
-    if (!CommandLineParser::instance()->contains("dry-run")) {
-      io->putChar('\n');
-    }
+    writeGitIgnore(txn, gitIgnorePath, QByteArray());
 
     return EXIT_SUCCESS;
 }
@@ -1268,20 +4264,16 @@ int SvnRevision::checkParentNoLongerEmpty(apr_pool_t *pool, const char *key, QSt
     }
     QString parentKey = qkey.left(index);
 
-    AprAutoPool subpool(pool);
-    svn_fs_root_t *previous_fs_root;
-    if (svn_fs_revision_root(&previous_fs_root, fs, revnum - 1, subpool) != SVN_NO_ERROR) {
-        return EXIT_FAILURE;
-    }
-
-    apr_hash_t *entries;
+    int count;
     // directory did not exist
-    if (svn_fs_dir_entries(&entries, previous_fs_root, parentKey.toStdString().c_str(), pool) != SVN_NO_ERROR) {
+    svn_error_t *err = dirEntryCount(&count, NULL, revnum - 1, parentKey.toStdString().c_str(), pool);
+    if (err != SVN_NO_ERROR) {
+        svn_error_clear(err);
         return EXIT_FAILURE;
     }
 
     // directory was not empty
-    if (apr_hash_count(entries)!=0) {
+    if (count > 0) {
         return EXIT_FAILURE;
     }
 
@@ -1301,6 +4293,12 @@ int SvnRevision::checkParentNoLongerEmpty(apr_pool_t *pool, const char *key, QSt
     // even if then an empty .gitignore might be left over
     QString svnignore;
     if (CommandLineParser::instance()->contains("svn-ignore")) {
+        svn_fs_root_t *previous_fs_root;
+        err = rootCache->revisionRoot(&previous_fs_root, revnum - 1);
+        if (err != SVN_NO_ERROR) {
+            svn_error_clear(err);
+            return EXIT_FAILURE;
+        }
         if (fetchIgnoreProps(&svnignore, pool, parentKey.toStdString().c_str(), previous_fs_root) != EXIT_SUCCESS) {
             qWarning() << "Error fetching svn-properties (" << parentKey << ")";
             return EXIT_FAILURE;
@@ -1318,39 +4316,21 @@ int SvnRevision::checkParentNoLongerEmpty(apr_pool_t *pool, const char *key, QSt
 int SvnRevision::addGitIgnoreOnBranch(apr_pool_t *pool, QString key, QString path,
                                       svn_fs_root_t *fs_root, Repository::Transaction *txn)
 {
-    apr_hash_t *entries;
-    if (svn_fs_dir_entries(&entries, fs_root, key.toStdString().c_str(), pool) != SVN_NO_ERROR) {
-        return EXIT_FAILURE;
-    }
+    if (walker)
+        walker->walk(svn_fs_revision_root_revision(fs_root), key.toUtf8(), TreeWalker::DirectoriesOnly);
 
-#if QT_VERSION >= 0x060000
-    QMultiMap<QByteArray, svn_node_kind_t> map;
-#else
-    QMap<QByteArray, svn_node_kind_t> map;
-#endif
-    for (apr_hash_index_t *i = apr_hash_first(pool, entries); i; i = apr_hash_next(i)) {
-        const void *vkey;
-        void *value;
-        apr_hash_this(i, &vkey, NULL, &value);
-        svn_fs_dirent_t *dirent = reinterpret_cast<svn_fs_dirent_t *>(value);
-#if QT_VERSION >= 0x060000
-        map.insert(QByteArray(dirent->name), dirent->kind);
-#else
-        map.insertMulti(QByteArray(dirent->name), dirent->kind);
-#endif
+    DirEntryList entries;
+    svn_error_t *err = dirCache->entries(&entries, fs_root, key.toStdString().c_str(), pool);
+    if (err != SVN_NO_ERROR) {
+        svn_error_clear(err);
+        return EXIT_FAILURE;
     }
 
-#if QT_VERSION >= 0x060000
-    QMultiMapIterator<QByteArray, svn_node_kind_t> i(map);
-#else
-    QMapIterator<QByteArray, svn_node_kind_t> i(map);
-#endif
-    while (i.hasNext()) {
-        i.next();
-        QString entryName = key + "/" + i.key();
-        QString entryFinalName = path + QString::fromUtf8(i.key());
+    foreach (const DirEntry &dirent, entries) {
+        QString entryName = key + "/" + QString::fromUtf8(dirent.name);
+        QString entryFinalName = path + QString::fromUtf8(dirent.name);
 
-        if (i.value() == svn_node_dir) {
+        if (dirent.kind == svn_node_dir) {
             entryFinalName += "/";
             if (addGitIgnore(pool, entryName.toStdString().c_str(), entryFinalName, fs_root, txn) == EXIT_FAILURE) {
                 addGitIgnoreOnBranch(pool, entryName, entryFinalName, fs_root, txn);
@@ -1361,13 +4341,13 @@ int SvnRevision::addGitIgnoreOnBranch(apr_pool_t *pool, QString key, QString pat
     return EXIT_SUCCESS;
 }
 
-int SvnRevision::fetchIgnoreProps(QString *ignore, apr_pool_t *pool, const char *key, svn_fs_root_t *fs_root)
+// the svn:ignore and svn:global-ignores properties as a .gitignore
+static void translateIgnoreProps(QString *ignore, const NodeProps &props)
 {
     // Get svn:ignore
-    svn_string_t *prop = NULL;
-    SVN_ERR(svn_fs_node_prop(&prop, fs_root, key, "svn:ignore", pool));
-    if (prop) {
-        *ignore = QString(prop->data);
+    NodeProps::ConstIterator prop = props.constFind("svn:ignore");
+    if (prop != props.constEnd()) {
+        *ignore = QString::fromUtf8(prop.value().constData());
         // remove patterns with slashes or backslashes,
         // they didn't match anything in Subversion but would in Git eventually
 #if QT_VERSION >= 0x060000
@@ -1389,10 +4369,9 @@ int SvnRevision::fetchIgnoreProps(QString *ignore, apr_pool_t *pool, const char
     }
 
     // Get svn:global-ignores
-    prop = NULL;
-    SVN_ERR(svn_fs_node_prop(&prop, fs_root, key, "svn:global-ignores", pool));
-    if (prop) {
-        QString global_ignore = QString(prop->data);
+    prop = props.constFind("svn:global-ignores");
+    if (prop != props.constEnd()) {
+        QString global_ignore = QString::fromUtf8(prop.value().constData());
         // remove patterns with slashes or backslashes,
         // they didn't match anything in Subversion but would in Git eventually
 #if QT_VERSION >= 0x060000
@@ -1411,22 +4390,79 @@ int SvnRevision::fetchIgnoreProps(QString *ignore, apr_pool_t *pool, const char
 #else
     ignore->replace(QRegExp("\\*+"), "*");
 #endif
+}
+
+int SvnRevision::fetchIgnoreProps(QString *ignore, apr_pool_t *pool, const char *key, svn_fs_root_t *fs_root)
+{
+    NodeProps props;
+    SVN_ERR(propCache->props(&props, fs_root, key, pool));
+
+    // the translation takes several regular expression passes, and most
+    // directories share one of a few property values
+    static const int maxTranslations = 4096;
+    static QHash<QByteArray, QString> translations;
+    QByteArray translationKey;
+    foreach (const char *name, QList<const char *>() << "svn:ignore" << "svn:global-ignores") {
+        NodeProps::ConstIterator prop = props.constFind(name);
+        if (prop == props.constEnd())
+            translationKey += '-';
+        else
+            translationKey += '+' + QByteArray::number(prop.value().size()) + ':' + prop.value();
+    }
 
+    QHash<QByteArray, QString>::ConstIterator it = translations.constFind(translationKey);
+    if (it != translations.constEnd()) {
+        Stats::instance()->cacheHit("svn:ignore translation");
+        *ignore = it.value();
+        return EXIT_SUCCESS;
+    }
+
+    Stats::instance()->cacheMiss("svn:ignore translation");
+    translateIgnoreProps(ignore, props);
+    if (translations.size() >= maxTranslations)
+        translations.clear();
+    translations.insert(translationKey, *ignore);
     return EXIT_SUCCESS;
 }
 
+// false if svn:ignore and svn:global-ignores of key are the same as in
+// the previous revision, or of previous_key in previous_fs_root if given,
+// and only other properties changed
+bool SvnRevision::ignorePropsChanged(apr_pool_t *pool, const char *key,
+                                     svn_fs_root_t *previous_fs_root, const char *previous_key)
+{
+    svn_error_t *err = SVN_NO_ERROR;
+    if (!previous_fs_root)
+        err = rootCache->revisionRoot(&previous_fs_root, revnum - 1);
+    NodeProps props, previous;
+    if (!err)
+        err = propCache->props(&props, fs_root, key, pool);
+    if (!err)
+        err = propCache->props(&previous, previous_fs_root, previous_key ? previous_key : key, pool);
+    if (err) {
+        svn_error_clear(err);
+        return true;
+    }
+
+    return props.value("svn:ignore") != previous.value("svn:ignore")
+        || props.value("svn:global-ignores") != previous.value("svn:global-ignores")
+        || props.contains("svn:ignore") != previous.contains("svn:ignore")
+        || props.contains("svn:global-ignores") != previous.contains("svn:global-ignores");
+}
+
 int SvnRevision::fetchUnknownProps(apr_pool_t *pool, const char *key, svn_fs_root_t *fs_root)
 {
     // Check all properties
-    apr_hash_t *table;
-    SVN_ERR(svn_fs_node_proplist(&table, fs_root, key, pool));
-    apr_hash_index_t *hi;
-    void *propVal;
-    const void *propKey;
-    for (hi = apr_hash_first(pool, table); hi; hi = apr_hash_next(hi)) {
-        apr_hash_this(hi, &propKey, NULL, &propVal);
-        if (strcmp((char*)propKey, "svn:ignore")!=0 && strcmp((char*)propKey, "svn:global-ignores")!=0 && strcmp((char*)propKey, "svn:mergeinfo") !=0) {
-            qWarning() << "WARN: Unknown svn-property" << (char*)propKey << "set to" << ((svn_string_t*)propVal)->data << "for" << key;
+    NodeProps props;
+    SVN_ERR(propCache->props(&props, fs_root, key, pool));
+    NodeProps::ConstIterator it = props.constBegin();
+    for ( ; it != props.constEnd(); ++it) {
+        if (it.key() == "svn:eol-style" && CommandLineParser::instance()->contains("svn-eol-style"))
+            continue;
+        if (it.key() == "svn:keywords" && CommandLineParser::instance()->contains("svn-keywords"))
+            continue;
+        if (it.key() != "svn:ignore" && it.key() != "svn:global-ignores" && it.key() != "svn:mergeinfo") {
+            qWarning() << "WARN: Unknown svn-property" << it.key().constData() << "set to" << it.value().constData() << "for" << key;
         }
     }
 
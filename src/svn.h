@@ -39,6 +39,9 @@ public:
     void setIdentityDomain(const QString &identityDomain);
 
     int youngestRevision();
+    bool waitForRevision(int revnum);
+    bool inputFailed();
+    void prefetchRevisions(const QList<int> &revisions);
     bool exportRevision(int revnum);
 
 private:
@@ -0,0 +1,34 @@
+load 'common'
+
+@test 'blob-cache parameter should reuse the blobs of an earlier run' {
+    svn mkdir dir-a
+    echo 'content a' >dir-a/file-a
+    svn add dir-a/file-a
+    svn commit -m 'add dir-a/file-a'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --blob-cache blob-cache --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+    svn2git "$SVN_REPO" --blob-cache blob-cache --rules <(echo "
+        create repository git-repo-2
+        end repository
+
+        match /
+            repository git-repo-2
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master:dir-a/file-a)" 'content a'
+    assert_equal "$(git -C git-repo-2 show master:dir-a/file-a)" 'content a'
+    assert_equal "$(git -C git-repo-2 rev-parse master)" "$(git -C git-repo rev-parse master)"
+    assert_equal "$(cat git-repo-2/objects/info/alternates)" "$TEST_TEMP_DIR/blob-cache/objects"
+    assert_equal "$(git -C blob-cache cat-file -p "$(git -C git-repo rev-parse master:dir-a/file-a)")" 'content a'
+}
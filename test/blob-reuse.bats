@@ -0,0 +1,32 @@
+load 'common'
+
+@test 'repeated file contents should be exported correctly and sent only once' {
+    svn mkdir dir-a
+    echo 'content a' >dir-a/file-a
+    svn add dir-a/file-a
+    svn commit -m 'add dir-a/file-a'
+    echo 'content b' >dir-a/file-a
+    svn commit -m 'change dir-a/file-a'
+    echo 'content a' >dir-a/file-a
+    svn commit -m 'revert dir-a/file-a'
+    echo 'content a' >dir-a/file-b
+    svn add dir-a/file-b
+    svn commit -m 'add dir-a/file-b with the same contents'
+
+    cd "$TEST_TEMP_DIR"
+    run svn2git "$SVN_REPO" --stats --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_success
+    assert_output --partial 'Blob bytes not sent again: 20'
+    assert_equal "$(git -C git-repo show master~2:dir-a/file-a)" 'content b'
+    assert_equal "$(git -C git-repo show master~1:dir-a/file-a)" 'content a'
+    assert_equal "$(git -C git-repo show master:dir-a/file-b)" 'content a'
+}
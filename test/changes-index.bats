@@ -0,0 +1,71 @@
+load 'common'
+
+@test 'changes-index parameter should create an index and export the same history' {
+    svn mkdir project-a project-b
+    svn commit -m 'add project-a and project-b'
+    echo 'content a' >project-a/file-a
+    svn add project-a/file-a
+    svn commit -m 'add project-a/file-a'
+    echo 'content b' >project-b/file-b
+    svn add project-b/file-b
+    svn commit -m 'add project-b/file-b'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --changes-index changes.idx --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /project-a/
+            repository git-repo
+            branch master
+        end match
+
+        match /
+        end match
+    ")
+
+    assert_file_exist changes.idx
+    assert_equal "$(git -C git-repo show master:file-a)" 'content a'
+    assert_equal "$(git -C git-repo rev-list --count master)" '1'
+}
+
+@test 'changes-index parameter should reuse and extend an existing index' {
+    svn mkdir project-a
+    svn commit -m 'add project-a'
+    echo 'content a' >project-a/file-a
+    svn add project-a/file-a
+    svn commit -m 'add project-a/file-a'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --changes-index changes.idx --dry-run --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+        end match
+    ")
+
+    cd "$SVN_WORKTREE"
+    echo 'content b' >project-a/file-b
+    svn add project-a/file-b
+    svn commit -m 'add project-a/file-b'
+
+    cd "$TEST_TEMP_DIR"
+    run svn2git "$SVN_REPO" --changes-index changes.idx --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /project-a/
+            repository git-repo
+            branch master
+        end match
+
+        match /
+        end match
+    ")
+
+    assert_success
+    assert_output --partial 'Indexing the changed paths of 1 revisions'
+    assert_equal "$(git -C git-repo show master:file-a)" 'content a'
+    assert_equal "$(git -C git-repo show master:file-b)" 'content b'
+}
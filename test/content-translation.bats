@@ -0,0 +1,47 @@
+load 'common'
+
+@test 'svn-eol-style parameter should normalize the line endings of files with svn:eol-style' {
+    printf 'line 1\r\nline 2\rline 3\n' >"$TEST_TEMP_DIR/file-a"
+    printf 'line 1\r\n' >"$TEST_TEMP_DIR/file-b"
+    svnmucc -m 'add files with CRLF' \
+        put "$TEST_TEMP_DIR/file-a" "file:///$SVN_REPO/file-a" \
+        propset svn:eol-style native "file:///$SVN_REPO/file-a" \
+        put "$TEST_TEMP_DIR/file-b" "file:///$SVN_REPO/file-b"
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --svn-eol-style --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master:file-a | od -An -c | tr -s ' ')" "$(printf 'line 1\nline 2\nline 3\n' | od -An -c | tr -s ' ')"
+    assert_equal "$(git -C git-repo show master:file-b | od -An -c | tr -s ' ')" "$(printf 'line 1\r\n' | od -An -c | tr -s ' ')"
+}
+
+@test 'svn-keywords parameter should unexpand the keywords listed in svn:keywords' {
+    printf '$Id: file-a 1 2020-01-01 someone $\n$Rev:: 12 $\n$Author: someone $\n' >"$TEST_TEMP_DIR/file-a"
+    svnmucc -m 'add file-a with expanded keywords' \
+        put "$TEST_TEMP_DIR/file-a" "file:///$SVN_REPO/file-a" \
+        propset svn:keywords 'Id Revision' "file:///$SVN_REPO/file-a"
+    svnmucc -m 'add Author to svn:keywords of file-a' \
+        propset svn:keywords 'Id Revision Author' "file:///$SVN_REPO/file-a"
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --svn-keywords --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master~1:file-a)" "$(printf '$Id$\n$Rev::    $\n$Author: someone $')"
+    assert_equal "$(git -C git-repo show master:file-a)" "$(printf '$Id$\n$Rev::    $\n$Author$')"
+}
@@ -26,3 +26,171 @@ load 'common'
 
     assert git -C git-repo show master:dir-a/file-a
 }
+
+@test 'copying a directory within a branch should take over the tree and apply the changes made with the copy' {
+    svn mkdir --parents dir-a/subdir-a
+    echo 'content a' >dir-a/file-a
+    echo 'content b' >dir-a/subdir-a/file-b
+    echo 'content c' >dir-a/file-c
+    svn add dir-a/file-a dir-a/subdir-a/file-b dir-a/file-c
+    svn commit -m 'add dir-a'
+    svn update
+    svn cp dir-a dir-b
+    echo 'changed b' >dir-b/subdir-a/file-b
+    svn rm dir-b/file-c
+    svn commit -m 'copy dir-a to dir-b with changes'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master:dir-b/file-a)" 'content a'
+    assert_equal "$(git -C git-repo show master:dir-b/subdir-a/file-b)" 'changed b'
+    refute git -C git-repo show master:dir-b/file-c
+    assert_equal "$(git -C git-repo show master:dir-a/subdir-a/file-b)" 'content b'
+}
+
+@test 'branching with svn-branches should add directories the source branch did not export' {
+    svn mkdir --parents trunk/dir-a trunk/dir-b
+    echo 'content a' >trunk/dir-a/file-a
+    echo 'content b' >trunk/dir-b/file-b
+    svn add trunk/dir-a/file-a trunk/dir-b/file-b
+    svn commit -m 'add trunk'
+    svn mkdir branches
+    svn cp trunk branches/branch-a
+    svn commit -m 'create branch-a'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --svn-branches --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /trunk/dir-b/
+        end match
+
+        match /trunk/
+            repository git-repo
+            branch master
+        end match
+
+        match /branches/$
+            action recurse
+        end match
+
+        match /branches/([^/]+)/
+            repository git-repo
+            branch \1
+        end match
+    ")
+
+    refute git -C git-repo show master:dir-b/file-b
+    assert_equal "$(git -C git-repo show branch-a:dir-a/file-a)" 'content a'
+    assert_equal "$(git -C git-repo show branch-a:dir-b/file-b)" 'content b'
+}
+
+@test 'moving directories within a branch should keep their contents' {
+    svn mkdir dir-b dir-y
+    echo 'content b' >dir-b/file-b
+    echo 'content y' >dir-y/file-y
+    svn add dir-b/file-b dir-y/file-y
+    svn commit -m 'add dir-b and dir-y'
+    svn mv dir-b dir-c
+    svn mv dir-y dir-a
+    svn commit -m 'move dir-b to dir-c and dir-y to dir-a'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master:dir-c/file-b)" 'content b'
+    assert_equal "$(git -C git-repo show master:dir-a/file-y)" 'content y'
+    refute git -C git-repo show master:dir-b/file-b
+    refute git -C git-repo show master:dir-y/file-y
+}
+
+@test 'copying a subdirectory of a branch to a new branch should take over its tree' {
+    svn mkdir --parents trunk/dir-a/subdir-a
+    echo 'content a' >trunk/dir-a/subdir-a/file-a
+    echo 'content b' >trunk/dir-a/file-b
+    svn add trunk/dir-a/subdir-a/file-a trunk/dir-a/file-b
+    svn commit -m 'add trunk/dir-a'
+    svn mkdir branches
+    svn cp trunk/dir-a branches/branch-a
+    svn commit -m 'create branch-a from trunk/dir-a'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /trunk/
+            repository git-repo
+            branch master
+        end match
+
+        match /branches/$
+            action recurse
+        end match
+
+        match /branches/([^/]+)/
+            repository git-repo
+            branch \1
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show branch-a:subdir-a/file-a)" 'content a'
+    assert_equal "$(git -C git-repo show branch-a:file-b)" 'content b'
+    refute git -C git-repo show branch-a:dir-a/file-b
+}
+
+@test 'branching with svn-branches should add files a rule kept out of an unchanged source directory' {
+    svn mkdir --parents trunk/dir-a/subdir-a
+    echo 'content a' >trunk/dir-a/subdir-a/file-a
+    echo 'content b' >trunk/dir-a/subdir-a/file-b
+    svn add trunk/dir-a/subdir-a/file-a trunk/dir-a/subdir-a/file-b
+    svn commit -m 'add trunk'
+    svn mkdir branches
+    svn cp trunk branches/branch-a
+    svn commit -m 'create branch-a'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --svn-branches --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /trunk/dir-a/subdir-a/file-b
+        end match
+
+        match /trunk/
+            repository git-repo
+            branch master
+        end match
+
+        match /branches/$
+            action recurse
+        end match
+
+        match /branches/([^/]+)/
+            repository git-repo
+            branch \1
+        end match
+    ")
+
+    refute git -C git-repo show master:dir-a/subdir-a/file-b
+    assert_equal "$(git -C git-repo show branch-a:dir-a/subdir-a/file-a)" 'content a'
+    assert_equal "$(git -C git-repo show branch-a:dir-a/subdir-a/file-b)" 'content b'
+}
@@ -0,0 +1,78 @@
+load 'common'
+
+@test 'dump parameter should load the dump into a new repository and export it' {
+    svn mkdir dir-a
+    echo 'content a' >dir-a/file-a
+    svn add dir-a/file-a
+    svn commit -m 'add dir-a/file-a'
+    svn cp dir-a dir-b
+    svn commit -m 'copy dir-a to dir-b'
+
+    cd "$TEST_TEMP_DIR"
+    svnadmin dump "$SVN_REPO" >dump
+    svn2git "$TEST_TEMP_DIR/loaded-repo" --dump dump --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master:dir-a/file-a)" 'content a'
+    assert_equal "$(git -C git-repo show master:dir-b/file-a)" 'content a'
+    assert_equal "$(svnlook youngest "$TEST_TEMP_DIR/loaded-repo")" '2'
+}
+
+@test 'dump parameter should read the dump from standard input' {
+    svn mkdir dir-a
+    echo 'content a' >dir-a/file-a
+    svn add dir-a/file-a
+    svn commit -m 'add dir-a/file-a'
+
+    cd "$TEST_TEMP_DIR"
+    svnadmin dump "$SVN_REPO" | svn2git "$TEST_TEMP_DIR/loaded-repo" --dump - --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master:dir-a/file-a)" 'content a'
+}
+
+@test 'dump parameter should load incremental dumps on top of the existing repository' {
+    svn mkdir dir-a
+    svn commit -m 'add dir-a'
+    echo 'content a' >dir-a/file-a
+    svn add dir-a/file-a
+    svn commit -m 'add dir-a/file-a'
+
+    cd "$TEST_TEMP_DIR"
+    svnadmin dump -r 1 "$SVN_REPO" >dump-1
+    svnadmin dump --incremental -r 2 "$SVN_REPO" >dump-2
+    svn2git "$TEST_TEMP_DIR/loaded-repo" --dump dump-1 --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+    svn2git "$TEST_TEMP_DIR/loaded-repo" --dump dump-2 --resume-from 2 --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master:dir-a/file-a)" 'content a'
+}
@@ -1093,3 +1093,33 @@ load 'common'
     assert_equal "$(git -C git-repo show master:dir-a/.gitignore)" '/ignore-a'
     assert_equal "$(git -C git-repo show branch-a:dir-a/.gitignore)" '/ignore-a'
 }
+
+@test 'emptying and refilling a directory over several revisions should track its .gitignore with empty-dirs-parameter' {
+    svn mkdir dir-a
+    touch dir-a/file-a dir-a/file-b
+    svn add dir-a/file-a dir-a/file-b
+    svn commit -m 'add dir-a/file-a and dir-a/file-b'
+    svn rm dir-a/file-a
+    svn commit -m 'delete dir-a/file-a'
+    svn rm dir-a/file-b
+    svn commit -m 'delete dir-a/file-b'
+    touch dir-a/file-c
+    svn add dir-a/file-c
+    svn commit -m 'add dir-a/file-c'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --empty-dirs --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    refute git -C git-repo show master~2:dir-a/.gitignore
+    assert_equal "$(git -C git-repo show master~1:dir-a/.gitignore)" ''
+    refute git -C git-repo show master:dir-a/.gitignore
+    assert_equal "$(git -C git-repo show master:dir-a/file-c)" ''
+}
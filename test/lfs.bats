@@ -0,0 +1,144 @@
+load 'common'
+
+@test 'lfs-threshold parameter should store large files as LFS pointers' {
+    svn mkdir dir-a
+    echo 'small' >dir-a/file-a
+    echo 'content that is large enough' >dir-a/file-b
+    svn add dir-a/file-a dir-a/file-b
+    svn commit -m 'add dir-a'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --lfs-threshold 20 --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    oid="$(echo 'content that is large enough' | sha256sum | cut -d ' ' -f 1)"
+    assert_equal "$(git -C git-repo show master:dir-a/file-a)" 'small'
+    assert_equal "$(git -C git-repo show master:dir-a/file-b)" "$(printf 'version https://git-lfs.github.com/spec/v1\noid sha256:%s\nsize 29' "$oid")"
+    assert_equal "$(cat "git-repo/lfs/objects/${oid:0:2}/${oid:2:2}/$oid")" 'content that is large enough'
+    assert_equal "$(git -C git-repo show master:.gitattributes)" '/dir-a/file-b filter=lfs diff=lfs merge=lfs -text'
+}
+
+@test 'lfs rule should store matching files as LFS pointers and list the pattern' {
+    svn mkdir dir-a
+    echo 'image' >dir-a/file-a.png
+    echo 'text' >dir-a/file-b.txt
+    svn add dir-a/file-a.png dir-a/file-b.txt
+    svn commit -m 'add dir-a'
+    svn rm dir-a/file-a.png
+    svn commit -m 'remove dir-a/file-a.png'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --rules <(echo "
+        create repository git-repo
+            lfs *.png
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master~1:.gitattributes)" '*.png filter=lfs diff=lfs merge=lfs -text'
+    run git -C git-repo show master~1:dir-a/file-a.png
+    assert_output --partial 'oid sha256:'
+    assert_equal "$(git -C git-repo show master:dir-a/file-b.txt)" 'text'
+    refute git -C git-repo show master:.gitattributes
+}
+
+@test 'lfs rule should match paths the way gitattributes does' {
+    svn mkdir dir-a dir-a/dir-b
+    echo 'image a' >file-a.png
+    echo 'image b' >dir-a/file-b.png
+    echo 'image c' >dir-a/dir-b/file-c.png
+    echo 'image d' >dir-a/dir-b/file-d.jpg
+    echo 'image e' >file-e.jpg
+    svn add file-a.png dir-a/file-b.png dir-a/dir-b/file-c.png dir-a/dir-b/file-d.jpg file-e.jpg
+    svn commit -m 'add images'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --rules <(echo "
+        create repository git-repo
+            lfs dir-a/*.png
+            lfs **/*.jpg
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master:file-a.png)" 'image a'
+    run git -C git-repo show master:dir-a/file-b.png
+    assert_output --partial 'oid sha256:'
+    assert_equal "$(git -C git-repo show master:dir-a/dir-b/file-c.png)" 'image c'
+    run git -C git-repo show master:dir-a/dir-b/file-d.jpg
+    assert_output --partial 'oid sha256:'
+    run git -C git-repo show master:file-e.jpg
+    assert_output --partial 'oid sha256:'
+}
+
+@test 'lfs files of an earlier run should keep their attributes when resuming' {
+    echo 'image' >file-a.png
+    echo 'content that is large enough' >file-b
+    svn add file-a.png file-b
+    svn commit -m 'add file-a.png and file-b'
+    svn rm file-b
+    svn commit -m 'remove file-b'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --lfs-threshold 20 --max-rev 1 --rules <(echo "
+        create repository git-repo
+            lfs *.png
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+    svn2git "$SVN_REPO" --lfs-threshold 20 --resume-from 2 --rules <(echo "
+        create repository git-repo
+            lfs *.png
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master~1:.gitattributes)" "$(printf '*.png filter=lfs diff=lfs merge=lfs -text\n/file-b filter=lfs diff=lfs merge=lfs -text')"
+    assert_equal "$(git -C git-repo show master:.gitattributes)" '*.png filter=lfs diff=lfs merge=lfs -text'
+}
+
+@test 'lfs attributes should replace a .gitattributes of the svn tree' {
+    echo 'image' >file-a.png
+    svn add file-a.png
+    svn commit -m 'add file-a.png'
+    echo '*.txt text' >.gitattributes
+    svn add .gitattributes
+    svn commit -m 'add .gitattributes'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --rules <(echo "
+        create repository git-repo
+            lfs *.png
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master:.gitattributes)" '*.png filter=lfs diff=lfs merge=lfs -text'
+}
@@ -0,0 +1,45 @@
+load 'common'
+
+@test 'the first rule matching a path in a revision should be used' {
+    svn mkdir project
+    echo 'content a' >project/file-a
+    svn add project/file-a
+    svn commit -m 'add project/file-a'
+    echo 'content b' >project/file-b
+    svn add project/file-b
+    svn commit -m 'add project/file-b'
+    echo 'content c' >project/file-c
+    svn add project/file-c
+    echo 'content b changed' >project/file-b
+    svn commit -m 'add project/file-c and change project/file-b'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /project/file-b
+            min revision 3
+            max revision 3
+        end match
+
+        match /proj(ect)?/file-[ab]
+            repository git-repo
+            branch master
+        end match
+
+        match /project/
+            max revision 2
+            repository git-repo
+            branch master
+        end match
+
+        match /
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master:file-a)" 'content a'
+    assert_equal "$(git -C git-repo show master:file-b)" 'content b'
+    refute git -C git-repo show master:file-c
+    assert_equal "$(git -C git-repo rev-list --count master)" '2'
+}
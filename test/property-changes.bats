@@ -0,0 +1,54 @@
+load 'common'
+
+@test 'changing a property of a file should keep its contents' {
+    svn mkdir dir-a
+    echo 'content a' >dir-a/file-a
+    svn add dir-a/file-a
+    svn commit -m 'add dir-a/file-a'
+    svn propset svn:mime-type text/plain dir-a/file-a
+    svn commit -m 'set svn:mime-type on dir-a/file-a'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo rev-list --count master)" '2'
+    assert_equal "$(git -C git-repo show master:dir-a/file-a)" 'content a'
+    assert_equal "$(git -C git-repo ls-tree master dir-a/file-a | cut -d' ' -f1)" '100644'
+}
+
+@test 'toggling svn:executable on a file should only change its mode' {
+    svn mkdir dir-a
+    echo 'content a' >dir-a/file-a
+    svn add dir-a/file-a
+    svn commit -m 'add dir-a/file-a'
+    svn propset svn:executable '*' dir-a/file-a
+    svn commit -m 'make dir-a/file-a executable'
+    svn propdel svn:executable dir-a/file-a
+    svn commit -m 'make dir-a/file-a not executable'
+    svn propset svn:executable '*' dir-a/file-a
+    svn commit -m 'make dir-a/file-a executable again'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo ls-tree master~2 dir-a/file-a | cut -d' ' -f1)" '100755'
+    assert_equal "$(git -C git-repo ls-tree master~1 dir-a/file-a | cut -d' ' -f1)" '100644'
+    assert_equal "$(git -C git-repo ls-tree master dir-a/file-a | cut -d' ' -f1)" '100755'
+    assert_equal "$(git -C git-repo show master:dir-a/file-a)" 'content a'
+}
@@ -0,0 +1,37 @@
+load 'common'
+
+refs() {
+    for repository in "$1"/*/; do
+        echo "$repository"
+        git -C "$repository" for-each-ref --format='%(objectname) %(refname)'
+    done
+}
+
+@test 'the sample rules should export the same with PCRE2 and QRegExp' {
+    for dir in trunk trunk/project1 branches/b1 branches/b1/project2 branches/abandoned-work tags/t1 \
+               project1/trunk project2/trunk project1/branches/b1; do
+        svn mkdir --parents "$dir"
+        echo "content of $dir" >"$dir/file"
+        svn add "$dir/file"
+    done
+    svn commit -m 'add the layouts of all samples'
+    svn cp trunk branches/b2
+    svn cp project1/trunk project1/branches/b2
+    svn commit -m 'add branches'
+
+    # the paths a sample does not cover are ignored
+    echo '
+        match /
+        end match
+    ' >"$TEST_TEMP_DIR/ignore.rules"
+
+    for rules in "$BATS_TEST_DIRNAME"/../samples/*.rules; do
+        mkdir "$TEST_TEMP_DIR/pcre" "$TEST_TEMP_DIR/qregexp"
+        (cd "$TEST_TEMP_DIR/pcre" && svn2git "$SVN_REPO" --rules "$rules,$TEST_TEMP_DIR/ignore.rules")
+        (cd "$TEST_TEMP_DIR/qregexp" && svn2git "$SVN_REPO" --qregexp --rules "$rules,$TEST_TEMP_DIR/ignore.rules")
+
+        assert [ -n "$(refs "$TEST_TEMP_DIR/pcre" | grep refs/heads/)" ]
+        assert_equal "$(cd "$TEST_TEMP_DIR/pcre" && refs .)" "$(cd "$TEST_TEMP_DIR/qregexp" && refs .)"
+        rm -rf "$TEST_TEMP_DIR/pcre" "$TEST_TEMP_DIR/qregexp"
+    done
+}
@@ -771,3 +771,32 @@ load 'common'
     assert git -C git-repo show master:dir-a/.gitignore
     assert_equal "$(git -C git-repo show master:dir-a/.gitignore)" ''
 }
+
+@test 'changing another property should keep the .gitignore file with svn-ignore-parameter' {
+    svn mkdir dir-a
+    svn commit -m 'add dir-a'
+    svn update
+    svn propset svn:ignore 'ignore-a' dir-a
+    svn commit -m 'ignore ignore-a on dir-a'
+    svn update
+    svn propset some:prop value-a dir-a
+    svn commit -m 'set some:prop on dir-a'
+    svn mkdir dir-b
+    svn propset svn:ignore 'ignore-a' dir-b
+    svn commit -m 'add dir-b with the same svn:ignore'
+
+    cd "$TEST_TEMP_DIR"
+    svn2git "$SVN_REPO" --svn-ignore --empty-dirs --rules <(echo "
+        create repository git-repo
+        end repository
+
+        match /
+            repository git-repo
+            branch master
+        end match
+    ")
+
+    assert_equal "$(git -C git-repo show master~1:dir-a/.gitignore)" '/ignore-a'
+    assert_equal "$(git -C git-repo show master:dir-a/.gitignore)" '/ignore-a'
+    assert_equal "$(git -C git-repo show master:dir-b/.gitignore)" '/ignore-a'
+}